@@ -0,0 +1,471 @@
+#include "common.h"
+#include "bench.h"
+#include "objparser.h"
+#include "parallel.h"
+#include "half.h"
+#include "mesh.h"
+#include "meshcodec.h"
+#include "scene.h"
+#include "cull.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <meshoptimizer.h>
+
+#include <GLFW/glfw3.h>
+
+#define FAST_OBJ_IMPLEMENTATION
+#include <fast_obj.h>
+
+static bool compareObj(const ObjFile& obj, const fastObjMesh* ref)
+{
+	if (obj.positions.size() != ref->position_count * 3 || obj.texcoords.size() != ref->texcoord_count * 2 || obj.normals.size() != ref->normal_count * 3)
+		return false;
+
+	if (obj.faceVertices.size() != ref->face_count || obj.indices.size() != ref->index_count)
+		return false;
+
+	if (memcmp(obj.positions.data(), ref->positions, obj.positions.size() * sizeof(float)) != 0 ||
+		memcmp(obj.texcoords.data(), ref->texcoords, obj.texcoords.size() * sizeof(float)) != 0 ||
+		memcmp(obj.normals.data(), ref->normals, obj.normals.size() * sizeof(float)) != 0 ||
+		memcmp(obj.faceVertices.data(), ref->face_vertices, obj.faceVertices.size() * sizeof(unsigned int)) != 0)
+		return false;
+
+	for (size_t i = 0; i < obj.indices.size(); ++i)
+		if (obj.indices[i].p != ref->indices[i].p || obj.indices[i].t != ref->indices[i].t || obj.indices[i].n != ref->indices[i].n)
+			return false;
+
+	return true;
+}
+
+static void benchObj(const char* path)
+{
+	double start = glfwGetTime();
+	fastObjMesh* ref = fast_obj_read(path);
+	double refTime = glfwGetTime() - start;
+
+	if (!ref) {
+		printf("Error loading %s: file not found\n", path);
+		return;
+	}
+
+	ObjFile obj;
+	if (!parseObj(obj, path)) {
+		fast_obj_destroy(ref);
+		return;
+	}
+
+	double sizeMB = double(obj.fileSize) / (1024 * 1024);
+
+	printf("OBJ %s: %.1f MB, %d faces\n", path, sizeMB, int(obj.faceVertices.size()));
+	printf("  fast_obj: %.2f ms, %.1f MB/s\n", refTime * 1000, sizeMB / refTime);
+
+	for (unsigned int threadCount = 1; ; threadCount = getThreadCount()) {
+		double bestTime = 1e9;
+
+		for (int run = 0; run < 3; ++run) {
+			obj = ObjFile();
+
+			double runStart = glfwGetTime();
+			parseObj(obj, path, threadCount);
+			bestTime = std::min(bestTime, glfwGetTime() - runStart);
+		}
+
+		printf("  parseObj (%u threads): %.2f ms, %.1f MB/s, %s\n", threadCount, bestTime * 1000, sizeMB / bestTime, compareObj(obj, ref) ? "identical" : "MISMATCH");
+
+		if (threadCount == getThreadCount())
+			break;
+	}
+
+	fast_obj_destroy(ref);
+}
+
+// The per-component conversion buildMeshletCones used before the batch kernels, kept as a baseline
+static float halfToFloatReference(uint16_t v)
+{
+	uint16_t sign = v >> 15;
+	uint16_t exp = (v >> 10) & 31;
+	uint16_t mant = v & 1023;
+
+	if (exp == 0)
+		return 0.f;
+
+	return (sign ? -1.f : 1.f) * ldexpf(float(mant + 1024) / 1024.f, exp - 15);
+}
+
+template <typename Body>
+static double benchBest(const Body& body)
+{
+	double bestTime = 1e9;
+
+	for (int run = 0; run < 5; ++run) {
+		double start = glfwGetTime();
+		body();
+		bestTime = std::min(bestTime, glfwGetTime() - start);
+	}
+
+	return bestTime;
+}
+
+static void benchHalf()
+{
+	const size_t kCount = 16 << 20;
+
+	std::vector<float> floats(kCount);
+	std::vector<uint16_t> halves(kCount);
+	std::vector<float> results(kCount);
+
+	// mesh-like magnitudes with a few denormal and out of range values mixed in
+	unsigned int seed = 42;
+	for (size_t i = 0; i < kCount; ++i) {
+		seed = seed * 1664525 + 1013904223;
+		floats[i] = (float(seed >> 8) / float(1 << 24) - 0.5f) * ((i % 97 == 0) ? 1e-5f : (i % 101 == 0) ? 1e6f : 200.f);
+	}
+
+	const char* names[] = { "scalar", "SSE2", "F16C" };
+	HalfConversion best = getHalfConversion();
+
+	printf("Half conversion: %d values, best path %s\n", int(kCount), names[best]);
+
+	double refTime = benchBest([&]() {
+		for (size_t i = 0; i < kCount; ++i)
+			halves[i] = meshopt_quantizeHalf(floats[i]);
+	});
+
+	printf("  float->half meshopt_quantizeHalf: %.2f ms, %.0f M/s\n", refTime * 1000, kCount / refTime * 1e-6);
+
+	std::vector<uint16_t> expectedHalves(kCount);
+
+	for (int path = HalfConversion_Scalar; path <= best; ++path) {
+		setHalfConversion(HalfConversion(path));
+
+		double time = benchBest([&]() { convertFloatToHalf(halves.data(), floats.data(), kCount); });
+
+		if (path == HalfConversion_Scalar)
+			expectedHalves = halves;
+
+		bool identical = memcmp(halves.data(), expectedHalves.data(), kCount * sizeof(uint16_t)) == 0;
+
+		printf("  float->half %s: %.2f ms, %.0f M/s, %.1fx, %s\n", names[path], time * 1000, kCount / time * 1e-6, refTime / time, identical ? "identical" : "MISMATCH");
+	}
+
+	refTime = benchBest([&]() {
+		for (size_t i = 0; i < kCount; ++i)
+			results[i] = halfToFloatReference(halves[i]);
+	});
+
+	printf("  half->float ldexpf: %.2f ms, %.0f M/s\n", refTime * 1000, kCount / refTime * 1e-6);
+
+	std::vector<float> expected(kCount);
+
+	for (int path = HalfConversion_Scalar; path <= best; ++path) {
+		setHalfConversion(HalfConversion(path));
+
+		double time = benchBest([&]() { convertHalfToFloat(results.data(), halves.data(), kCount); });
+
+		if (path == HalfConversion_Scalar)
+			expected = results;
+
+		bool identical = memcmp(results.data(), expected.data(), kCount * sizeof(float)) == 0;
+
+		printf("  half->float %s: %.2f ms, %.0f M/s, %.1fx, %s\n", names[path], time * 1000, kCount / time * 1e-6, refTime / time, identical ? "identical" : "MISMATCH");
+	}
+
+	setHalfConversion(best);
+}
+
+// Cone test against the float apex, in mesh space
+static bool coneCull(const Meshlet& meshlet, const float* camera)
+{
+	float apex[3] = { meshlet.coneApex[0] - camera[0], meshlet.coneApex[1] - camera[1], meshlet.coneApex[2] - camera[2] };
+	float length = sqrtf(apex[0] * apex[0] + apex[1] * apex[1] + apex[2] * apex[2]);
+
+	return apex[0] * meshlet.coneAxis[0] + apex[1] * meshlet.coneAxis[1] + apex[2] * meshlet.coneAxis[2] >= meshlet.coneCutoff * length;
+}
+
+// Same test as coneCull in shaders/mesh.h with the 8-bit cone, in mesh space
+static bool coneCullS8(const Meshlet& meshlet, const float* camera)
+{
+	float center[3] = { meshlet.center[0] - camera[0], meshlet.center[1] - camera[1], meshlet.center[2] - camera[2] };
+	float length = sqrtf(center[0] * center[0] + center[1] * center[1] + center[2] * center[2]);
+
+	float axis[3] = { meshlet.coneAxisS8[0] / 127.f, meshlet.coneAxisS8[1] / 127.f, meshlet.coneAxisS8[2] / 127.f };
+	float cutoff = meshlet.coneCutoffS8 / 127.f;
+
+	return center[0] * axis[0] + center[1] * axis[1] + center[2] * axis[2] >= cutoff * length + meshlet.radius;
+}
+
+static void benchMeshlets(const char* path)
+{
+	Mesh source;
+	if (!loadMesh(source, path))
+		return;
+
+	// cameras spread evenly over a sphere around the mesh (Fibonacci lattice), so the cull rate does not depend on how the mesh is oriented
+	const int kViewCount = 256;
+	const float kViewDistance = 3.f; // in mesh radii
+	float views[kViewCount][3];
+
+	for (int i = 0; i < kViewCount; ++i) {
+		float z = 1.f - (2.f * i + 1.f) / kViewCount;
+		float r = sqrtf(1.f - z * z);
+		float phi = 2.39996323f * i;
+
+		views[i][0] = source.center[0] + r * cosf(phi) * source.radius * kViewDistance;
+		views[i][1] = source.center[1] + r * sinf(phi) * source.radius * kViewDistance;
+		views[i][2] = source.center[2] + z * source.radius * kViewDistance;
+	}
+
+	const char* names[] = { "greedy", "meshopt" };
+
+	// fill is against what each builder can put into a meshlet; meshopt_buildMeshlets is limited to 124 triangles, see buildMeshlets
+	const int maxTriangles[] = { 126, 124 };
+
+	printf("Meshlets: %d triangles\n", int(source.indices.size() / 3));
+
+	for (int builder = MeshletBuilder_Greedy; builder <= MeshletBuilder_Meshopt; ++builder) {
+		Mesh mesh = source;
+
+		double start = glfwGetTime();
+		buildMeshlets(mesh, MeshletBuilder(builder));
+		double buildTime = glfwGetTime() - start;
+
+		buildMeshletBounds(mesh);
+
+		size_t meshletCount = 0, vertexCount = 0, triangleCount = 0, culledCount = 0, culledCountS8 = 0;
+
+		for (const Meshlet& meshlet : mesh.meshlets) {
+			meshletCount++;
+			vertexCount += meshlet.vertexCount;
+			triangleCount += meshlet.triangleCount;
+
+			for (int i = 0; i < kViewCount; ++i) {
+				culledCount += coneCull(meshlet, views[i]);
+				culledCountS8 += coneCullS8(meshlet, views[i]);
+			}
+		}
+
+		// fixed size meshlets had room for 64 vertices and 126 triangles each and were padded to a multiple of 32
+		size_t packedSize = mesh.meshlets.size() * sizeof(Meshlet) + mesh.meshletVertices.size() * sizeof(uint32_t) + mesh.meshletTriangles.size();
+		size_t fixedSize = ((meshletCount + 31) & ~size_t(31)) * 656;
+
+		printf("  %s: %d meshlets, %.2f ms, fill %.1f%% vertices %.1f%% triangles, cone culled %.1f%% (%.1f%% with 8-bit cones), %.2f MB packed vs %.2f MB fixed\n",
+			names[builder], int(meshletCount), buildTime * 1000,
+			double(vertexCount) / double(meshletCount * 64) * 100, double(triangleCount) / double(meshletCount * maxTriangles[builder]) * 100,
+			double(culledCount) / double(meshletCount * kViewCount) * 100, double(culledCountS8) / double(meshletCount * kViewCount) * 100, double(packedSize) / (1024 * 1024), double(fixedSize) / (1024 * 1024));
+	}
+
+	// the output has to be the same no matter how the work is spread over threads
+	Mesh reference = source;
+	buildMeshlets(reference, MeshletBuilder_Meshopt, MeshletLimits(), 1);
+	buildMeshletBounds(reference, 1);
+
+	for (unsigned int threadCount = 1; ; threadCount = getThreadCount()) {
+		Mesh mesh = source;
+
+		double meshletTime = benchBest([&]() {
+			mesh.meshlets.clear();
+			mesh.meshletVertices.clear();
+			mesh.meshletTriangles.clear();
+
+			buildMeshlets(mesh, MeshletBuilder_Meshopt, MeshletLimits(), threadCount);
+		});
+
+		double boundsTime = benchBest([&]() { buildMeshletBounds(mesh, threadCount); });
+
+		bool identical =
+			mesh.meshlets.size() == reference.meshlets.size() &&
+			memcmp(mesh.meshlets.data(), reference.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet)) == 0 &&
+			mesh.meshletVertices == reference.meshletVertices && mesh.meshletTriangles == reference.meshletTriangles;
+
+		printf("  meshopt (%u threads): meshlets %.2f ms, bounds %.2f ms, %s\n", threadCount, meshletTime * 1000, boundsTime * 1000, identical ? "identical" : "MISMATCH");
+
+		if (threadCount == getThreadCount())
+			break;
+	}
+}
+
+static void benchCull(const char* path)
+{
+	std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+	if (!loadMesh(*mesh, path))
+		return;
+
+	buildMeshlets(*mesh);
+	buildMeshletBounds(*mesh);
+
+	// the whole mesh in one chunk; appendMeshChunk scales it to a unit sphere at the origin
+	std::vector<MeshChunk> chunks;
+	splitMesh(chunks, makeMeshData(mesh), mesh->indices.size());
+
+	Scene scene;
+	for (const MeshChunk& chunk : chunks)
+		appendMeshChunk(scene, chunk);
+
+	MeshletCullData data;
+	updateMeshletCullData(data, scene);
+
+	// cameras on a sphere around the mesh looking at its center, close enough that the frustum cuts some of it off
+	const int kViewCount = 64;
+	const float kViewDistance = 1.5f;
+	const float kFovY = 70.f * 3.14159265f / 180.f;
+
+	std::vector<CullCamera> cameras(kViewCount);
+
+	for (int i = 0; i < kViewCount; ++i) {
+		float z = 1.f - (2.f * i + 1.f) / kViewCount;
+		float r = sqrtf(1.f - z * z);
+		float phi = 2.39996323f * i;
+
+		vec3 position = { r * cosf(phi) * kViewDistance, r * sinf(phi) * kViewDistance, z * kViewDistance };
+
+		// same yaw and pitch as the camera in stairs.cpp, which looks down -Z when both are 0
+		float yaw = atan2f(position.x, position.z);
+		float pitch = -asinf(position.y / kViewDistance);
+		quat orientation = axisAngle({ 0, 1, 0 }, yaw) * axisAngle({ 1, 0, 0 }, pitch);
+
+		CullCamera& camera = cameras[i];
+		camera.view = viewMatrix(position, orientation);
+		camera.projection[1] = 1.f / tanf(kFovY / 2.f);
+		camera.projection[0] = camera.projection[1] * 9.f / 16.f;
+		camera.projection[2] = 0.05f;
+
+		float frustumX = sqrtf(camera.projection[0] * camera.projection[0] + 1.f);
+		float frustumY = sqrtf(camera.projection[1] * camera.projection[1] + 1.f);
+
+		camera.frustum[0] = camera.projection[0] / frustumX;
+		camera.frustum[1] = 1.f / frustumX;
+		camera.frustum[2] = camera.projection[1] / frustumY;
+		camera.frustum[3] = 1.f / frustumY;
+		camera.position = position;
+	}
+
+	std::vector<MeshTaskCommand> commands;
+	buildMeshTaskCommands(commands, scene, cameras[0].position, 0.f);
+
+	printf("CPU culling: %d meshlets, %d views\n", int(scene.meshlets.size()), kViewCount);
+
+	std::vector<VkDrawIndexedIndirectCommand> expected, result;
+	size_t expectedIndexCount = 0;
+
+	for (const CullCamera& camera : cameras) {
+		cullMeshlets(result, data, scene, commands, camera, 1);
+		expected.insert(expected.end(), result.begin(), result.end());
+
+		for (const VkDrawIndexedIndirectCommand& command : result)
+			expectedIndexCount += command.indexCount;
+	}
+
+	printf("  visible %.1f%% of triangles, %.1f commands per view\n", double(expectedIndexCount) / double(data.indices.size() * kViewCount) * 100, double(expected.size()) / kViewCount);
+
+	for (unsigned int threadCount = 1; ; threadCount = getThreadCount()) {
+		std::vector<VkDrawIndexedIndirectCommand> commandsAll;
+		size_t meshletCount = 0;
+
+		double time = benchBest([&]() {
+			commandsAll.clear();
+			meshletCount = 0;
+
+			for (const CullCamera& camera : cameras) {
+				meshletCount += cullMeshlets(result, data, scene, commands, camera, threadCount);
+				commandsAll.insert(commandsAll.end(), result.begin(), result.end());
+			}
+		});
+
+		bool identical = commandsAll.size() == expected.size() && memcmp(commandsAll.data(), expected.data(), expected.size() * sizeof(VkDrawIndexedIndirectCommand)) == 0;
+
+		printf("  cullMeshlets (%u threads): %.3f ms per view, %.0f meshlets/ms/core, %s\n", threadCount, time * 1000 / kViewCount,
+			double(meshletCount) / (time * 1000) / threadCount, identical ? "identical" : "MISMATCH");
+
+		if (threadCount == getThreadCount())
+			break;
+	}
+}
+
+// The index codec is free to rotate the corners of a triangle, so triangles are compared up to rotation
+static bool compareTriangles(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& expected)
+{
+	if (indices.size() != expected.size())
+		return false;
+
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		const uint32_t* a = &indices[i];
+		const uint32_t* b = &expected[i];
+
+		bool same =
+			(a[0] == b[0] && a[1] == b[1] && a[2] == b[2]) ||
+			(a[0] == b[1] && a[1] == b[2] && a[2] == b[0]) ||
+			(a[0] == b[2] && a[1] == b[0] && a[2] == b[1]);
+
+		if (!same)
+			return false;
+	}
+
+	return true;
+}
+
+static void benchCodec(const char* path)
+{
+	Mesh mesh;
+	if (!loadMesh(mesh, path))
+		return;
+
+	buildMeshlets(mesh);
+	buildMeshletBounds(mesh);
+
+	const double kMB = 1024 * 1024;
+
+	printf("Mesh codec: %d vertices, %d triangles, %d meshlets\n", int(mesh.vertices.size()), int(mesh.indices.size() / 3), int(mesh.meshlets.size()));
+
+	// each stream on its own, then everything together the way the mesh cache stores it
+	Mesh streams[4];
+	streams[0].vertices = mesh.vertices;
+	streams[1].indices = mesh.indices;
+	streams[2].meshlets = mesh.meshlets;
+	streams[2].meshletVertices = mesh.meshletVertices;
+	streams[2].meshletTriangles = mesh.meshletTriangles;
+	streams[3] = mesh;
+
+	const char* names[] = { "vertices", "indices", "meshlets", "total" };
+
+	std::vector<unsigned char> encoded;
+
+	for (int i = 0; i < 4; ++i) {
+		double encodeTime = benchBest([&]() { encodeMeshGeometry(encoded, streams[i]); });
+
+		size_t rawSize = getMeshGeometrySize(encoded.data(), encoded.size());
+
+		printf("  %s: %.2f MB -> %.2f MB, ratio %.2f, encode %.2f ms\n", names[i], rawSize / kMB, encoded.size() / kMB, double(rawSize) / double(encoded.size()), encodeTime * 1000);
+	}
+
+	size_t rawSize = getMeshGeometrySize(encoded.data(), encoded.size());
+
+	for (unsigned int threadCount = 1; ; threadCount = getThreadCount()) {
+		Mesh decoded;
+
+		double time = benchBest([&]() { decodeMeshGeometry(decoded, encoded.data(), encoded.size(), threadCount); });
+
+		bool identical =
+			decoded.vertices.size() == mesh.vertices.size() && decoded.meshlets.size() == mesh.meshlets.size() &&
+			memcmp(decoded.vertices.data(), mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex)) == 0 &&
+			compareTriangles(decoded.indices, mesh.indices) &&
+			memcmp(decoded.meshlets.data(), mesh.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet)) == 0 &&
+			decoded.meshletVertices == mesh.meshletVertices && decoded.meshletTriangles == mesh.meshletTriangles;
+
+		printf("  decode (%u threads): %.2f ms, %.2f GB/s, %s\n", threadCount, time * 1000, rawSize / time * 1e-9, identical ? "identical" : "MISMATCH");
+
+		if (threadCount == getThreadCount())
+			break;
+	}
+}
+
+void runBenchmarks(const char* path)
+{
+	benchHalf();
+	benchObj(path);
+	benchMeshlets(path);
+	benchCull(path);
+	benchCodec(path);
+}
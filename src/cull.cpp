@@ -0,0 +1,244 @@
+#include "common.h"
+#include "mesh.h"
+#include "scene.h"
+#include "cull.h"
+#include "parallel.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CULL_SSE 1
+#include <emmintrin.h>
+#endif
+
+void updateMeshletCullData(MeshletCullData& data, const Scene& scene)
+{
+	if (data.indexOffset.empty())
+		data.indexOffset.push_back(0);
+
+	for (size_t i = data.centerX.size(); i < scene.meshlets.size(); ++i) {
+		const Meshlet& meshlet = scene.meshlets[i];
+
+		data.centerX.push_back(meshlet.center[0]);
+		data.centerY.push_back(meshlet.center[1]);
+		data.centerZ.push_back(meshlet.center[2]);
+		data.radius.push_back(meshlet.radius);
+		data.coneApexX.push_back(meshlet.coneApex[0]);
+		data.coneApexY.push_back(meshlet.coneApex[1]);
+		data.coneApexZ.push_back(meshlet.coneApex[2]);
+		data.coneAxisX.push_back(meshlet.coneAxis[0]);
+		data.coneAxisY.push_back(meshlet.coneAxis[1]);
+		data.coneAxisZ.push_back(meshlet.coneAxis[2]);
+		data.coneCutoff.push_back(meshlet.coneCutoff);
+
+		// scene meshlet vertices are already rebased, so commands need no vertexOffset
+		for (unsigned int k = 0; k < meshlet.triangleCount * 3u; ++k)
+			data.indices.push_back(scene.meshletVertices[meshlet.vertexOffset + scene.meshletTriangles[meshlet.triangleOffset + k]]);
+
+		data.indexOffset.push_back(uint32_t(data.indices.size()));
+	}
+}
+
+// Everything the tests need about one draw: the mesh to view transform as 3 rows, and the camera in mesh space
+// A draw only scales uniformly, so the cone test gives the same answer in mesh space as in view space
+struct DrawCull {
+	float transform[12];
+	float scale;
+	vec3 camera;
+};
+
+static DrawCull getDrawCull(const MeshDraw& draw, const CullCamera& camera)
+{
+	quat orientation = { draw.orientation[0], draw.orientation[1], draw.orientation[2], draw.orientation[3] };
+	quat inverse = { -orientation.x, -orientation.y, -orientation.z, orientation.w };
+	vec3 position = { draw.position[0], draw.position[1], draw.position[2] };
+
+	vec3 axes[3] = {
+		rotate({ draw.scale, 0, 0 }, orientation),
+		rotate({ 0, draw.scale, 0 }, orientation),
+		rotate({ 0, 0, draw.scale }, orientation),
+	};
+
+	const float* view = camera.view.m;
+
+	DrawCull result = {};
+
+	for (int r = 0; r < 3; ++r) {
+		for (int c = 0; c < 3; ++c)
+			result.transform[r * 4 + c] = view[r] * axes[c].x + view[4 + r] * axes[c].y + view[8 + r] * axes[c].z;
+
+		result.transform[r * 4 + 3] = view[r] * position.x + view[4 + r] * position.y + view[8 + r] * position.z + view[12 + r];
+	}
+
+	result.scale = draw.scale;
+	result.camera = rotate(camera.position - position, inverse) * (1.f / draw.scale);
+
+	return result;
+}
+
+// sphereInFrustum in shaders/mesh.h, for a sphere in mesh space
+static bool sphereVisible(float x, float y, float z, float radius, const DrawCull& draw, const CullCamera& camera)
+{
+	const float* m = draw.transform;
+	const float* frustum = camera.frustum;
+
+	float vx = x * m[0] + y * m[1] + z * m[2] + m[3];
+	float vy = x * m[4] + y * m[5] + z * m[6] + m[7];
+	float vz = x * m[8] + y * m[9] + z * m[10] + m[11];
+	float vr = radius * draw.scale;
+
+	return fabsf(vx) * frustum[0] + vz * frustum[1] < vr && fabsf(vy) * frustum[2] + vz * frustum[3] < vr && vz - vr < -camera.projection[2];
+}
+
+static bool meshletVisible(const MeshletCullData& data, size_t i, const DrawCull& draw, const CullCamera& camera)
+{
+	if (!sphereVisible(data.centerX[i], data.centerY[i], data.centerZ[i], data.radius[i], draw, camera))
+		return false;
+
+	float dx = data.coneApexX[i] - draw.camera.x;
+	float dy = data.coneApexY[i] - draw.camera.y;
+	float dz = data.coneApexZ[i] - draw.camera.z;
+
+	float d = dx * data.coneAxisX[i] + dy * data.coneAxisY[i] + dz * data.coneAxisZ[i];
+
+	return !(d >= data.coneCutoff[i] * sqrtf(dx * dx + dy * dy + dz * dz));
+}
+
+#ifdef CULL_SSE
+// meshletVisible for meshlets [i, i + 4); bit k of the result is set when meshlet i + k is visible
+static unsigned int meshletVisible4(const MeshletCullData& data, size_t i, const DrawCull& draw, const CullCamera& camera)
+{
+	const float* m = draw.transform;
+
+	__m128 x = _mm_loadu_ps(&data.centerX[i]);
+	__m128 y = _mm_loadu_ps(&data.centerY[i]);
+	__m128 z = _mm_loadu_ps(&data.centerZ[i]);
+	__m128 r = _mm_mul_ps(_mm_loadu_ps(&data.radius[i]), _mm_set1_ps(draw.scale));
+
+	__m128 vx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[0])), _mm_mul_ps(y, _mm_set1_ps(m[1]))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[2])), _mm_set1_ps(m[3])));
+	__m128 vy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[4])), _mm_mul_ps(y, _mm_set1_ps(m[5]))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[6])), _mm_set1_ps(m[7])));
+	__m128 vz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[8])), _mm_mul_ps(y, _mm_set1_ps(m[9]))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[10])), _mm_set1_ps(m[11])));
+
+	__m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	__m128 insideX = _mm_cmplt_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(vx, absMask), _mm_set1_ps(camera.frustum[0])), _mm_mul_ps(vz, _mm_set1_ps(camera.frustum[1]))), r);
+	__m128 insideY = _mm_cmplt_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(vy, absMask), _mm_set1_ps(camera.frustum[2])), _mm_mul_ps(vz, _mm_set1_ps(camera.frustum[3]))), r);
+	__m128 insideZ = _mm_cmplt_ps(_mm_sub_ps(vz, r), _mm_set1_ps(-camera.projection[2]));
+
+	__m128 dx = _mm_sub_ps(_mm_loadu_ps(&data.coneApexX[i]), _mm_set1_ps(draw.camera.x));
+	__m128 dy = _mm_sub_ps(_mm_loadu_ps(&data.coneApexY[i]), _mm_set1_ps(draw.camera.y));
+	__m128 dz = _mm_sub_ps(_mm_loadu_ps(&data.coneApexZ[i]), _mm_set1_ps(draw.camera.z));
+
+	__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&data.coneAxisX[i])), _mm_mul_ps(dy, _mm_loadu_ps(&data.coneAxisY[i]))), _mm_mul_ps(dz, _mm_loadu_ps(&data.coneAxisZ[i])));
+	__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+
+	__m128 backfacing = _mm_cmpge_ps(d, _mm_mul_ps(_mm_loadu_ps(&data.coneCutoff[i]), length));
+
+	return unsigned(_mm_movemask_ps(_mm_andnot_ps(backfacing, _mm_and_ps(_mm_and_ps(insideX, insideY), insideZ))));
+}
+#endif
+
+// Writes a command for every run of visible meshlets in [begin, end) and returns how many; there are at most (end - begin + 1) / 2 runs
+static size_t cullMeshletRange(VkDrawIndexedIndirectCommand* commands, const MeshletCullData& data, uint32_t begin, uint32_t end, uint32_t drawIndex, const DrawCull& draw, const CullCamera& camera)
+{
+	size_t count = 0;
+	uint32_t runBegin = ~0u;
+
+	auto addMeshlet = [&](uint32_t i, bool visible) {
+		if (visible && runBegin == ~0u) {
+			runBegin = i;
+		}
+		else if (!visible && runBegin != ~0u) {
+			VkDrawIndexedIndirectCommand& command = commands[count++];
+			command.indexCount = data.indexOffset[i] - data.indexOffset[runBegin];
+			command.instanceCount = 1;
+			command.firstIndex = data.indexOffset[runBegin];
+			command.vertexOffset = 0;
+			command.firstInstance = drawIndex;
+
+			runBegin = ~0u;
+		}
+	};
+
+	uint32_t i = begin;
+
+#ifdef CULL_SSE
+	for (; i + 4 <= end; i += 4) {
+		unsigned int mask = meshletVisible4(data, i, draw, camera);
+
+		for (uint32_t k = 0; k < 4; ++k)
+			addMeshlet(i + k, (mask & (1 << k)) != 0);
+	}
+#endif
+
+	for (; i < end; ++i)
+		addMeshlet(i, meshletVisible(data, i, draw, camera));
+
+	addMeshlet(end, false);
+
+	return count;
+}
+
+struct CullJob {
+	uint32_t commandIndex;
+	uint32_t begin, end; // meshlets
+	size_t commandOffset; // start of the job's space in the result
+	size_t commandCount;
+};
+
+size_t cullMeshlets(std::vector<VkDrawIndexedIndirectCommand>& result, const MeshletCullData& data, const Scene& scene, const std::vector<MeshTaskCommand>& commands, const CullCamera& camera, unsigned int threadCount)
+{
+	assert(commands.size() <= scene.draws.size());
+	assert(data.centerX.size() == scene.meshlets.size());
+
+	// large draws are split so that a few big meshes still spread over all threads
+	const uint32_t kJobMeshlets = 1024;
+
+	std::vector<DrawCull> draws(commands.size());
+	std::vector<CullJob> jobs;
+
+	size_t commandCount = 0;
+	size_t meshletCount = 0;
+
+	for (size_t i = 0; i < commands.size(); ++i) {
+		const MeshTaskCommand& command = commands[i];
+		const MeshDraw& draw = scene.draws[command.drawId];
+
+		draws[i] = getDrawCull(draw, camera);
+
+		if (!sphereVisible(draw.center[0], draw.center[1], draw.center[2], draw.radius, draws[i], camera))
+			continue;
+
+		for (uint32_t begin = 0; begin < command.meshletCount; begin += kJobMeshlets) {
+			uint32_t end = std::min(begin + kJobMeshlets, command.meshletCount);
+
+			CullJob job = { uint32_t(i), command.meshletOffset + begin, command.meshletOffset + end, commandCount, 0 };
+			jobs.push_back(job);
+
+			commandCount += (end - begin + 1) / 2;
+		}
+
+		meshletCount += command.meshletCount;
+	}
+
+	result.resize(commandCount);
+
+	parallelFor(jobs.size(), [&](size_t i) {
+		CullJob& job = jobs[i];
+		job.commandCount = cullMeshletRange(&result[job.commandOffset], data, job.begin, job.end, commands[job.commandIndex].drawId, draws[job.commandIndex], camera);
+	}, threadCount);
+
+	// jobs only fill the start of their space, so the commands are packed in job order
+	size_t offset = 0;
+
+	for (const CullJob& job : jobs) {
+		if (job.commandCount)
+			memmove(&result[offset], &result[job.commandOffset], job.commandCount * sizeof(VkDrawIndexedIndirectCommand));
+
+		offset += job.commandCount;
+	}
+
+	result.resize(offset);
+
+	return meshletCount;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <volk.h>
+
+#include "vecmath.h"
+
+struct Scene;
+struct MeshTaskCommand;
+
+// Meshlet bounds of the whole scene for culling on the CPU, one array per field so that 4 meshlets load into a SIMD register at once
+// indices holds the triangles of every meshlet in meshlet order with scene vertex indices; the commands from cullMeshlets draw from it
+struct MeshletCullData {
+	std::vector<float> centerX, centerY, centerZ, radius;
+	std::vector<float> coneApexX, coneApexY, coneApexZ;
+	std::vector<float> coneAxisX, coneAxisY, coneAxisZ, coneCutoff;
+
+	std::vector<uint32_t> indexOffset; // meshlet i covers [indexOffset[i], indexOffset[i + 1]) of indices
+	std::vector<uint32_t> indices;
+};
+
+// Same camera as Globals in shaders/mesh.h, plus its position in world space
+struct CullCamera {
+	mat4 view;
+	float projection[4];
+	float frustum[4];
+	vec3 position;
+};
+
+// Adds the meshlets that were appended to the scene since the last call
+void updateMeshletCullData(MeshletCullData& data, const Scene& scene);
+
+// Frustum and cone tests of meshletVisible in shaders/mesh.h for the meshlets commands selects for every draw; there is no occlusion test,
+// and cones are tested against the float apex, which culls a little more than the 8-bit cones the shaders read
+// Writes one command per run of consecutive visible meshlets, with firstInstance set to the draw index; runs on up to threadCount threads (0 = all cores)
+// and produces the same commands for any thread count; returns how many meshlets were tested
+size_t cullMeshlets(std::vector<VkDrawIndexedIndirectCommand>& result, const MeshletCullData& data, const Scene& scene, const std::vector<MeshTaskCommand>& commands, const CullCamera& camera, unsigned int threadCount = 0);
@@ -0,0 +1,162 @@
+#include "common.h"
+#include "fileio.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool mapFile(MappedFile& result, const char* path)
+{
+	result = {};
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	result.data = data;
+	result.size = size_t(size.QuadPart);
+	result.file = file;
+	result.mapping = mapping;
+#else
+	int file = open(path, O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(file, &st) != 0 || st.st_size == 0) {
+		close(file);
+		return false;
+	}
+
+	void* data = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+
+	if (data == MAP_FAILED)
+		return false;
+
+	result.data = data;
+	result.size = size_t(st.st_size);
+#endif
+
+	return true;
+}
+
+void unmapFile(MappedFile& file)
+{
+	if (!file.data)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle(file.mapping);
+	CloseHandle(file.file);
+#else
+	munmap(file.data, file.size);
+#endif
+
+	file = {};
+}
+
+bool getFileInfo(const char* path, uint64_t& size, uint64_t& time)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+		return false;
+
+	size = (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+	time = (uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return false;
+
+	size = uint64_t(st.st_size);
+#ifdef __APPLE__
+	time = uint64_t(st.st_mtimespec.tv_sec) * 1000000000ull + uint64_t(st.st_mtimespec.tv_nsec);
+#else
+	time = uint64_t(st.st_mtim.tv_sec) * 1000000000ull + uint64_t(st.st_mtim.tv_nsec);
+#endif
+#endif
+
+	return true;
+}
+
+static size_t getPageSize()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return size_t(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+void releaseFileRange(const MappedFile& file, size_t offset, size_t size)
+{
+	assert(offset <= file.size && size <= file.size - offset);
+
+	size_t pageSize = getPageSize();
+
+	// only whole pages inside the range can be released
+	size_t begin = (offset + pageSize - 1) / pageSize * pageSize;
+	size_t end = (offset + size) / pageSize * pageSize;
+
+	if (begin >= end)
+		return;
+
+	char* data = static_cast<char*>(file.data) + begin;
+
+#ifdef _WIN32
+	// unlocking pages that are not locked removes them from the working set
+	VirtualUnlock(data, end - begin);
+#else
+	madvise(data, end - begin, MADV_DONTNEED);
+#endif
+}
+
+void discardMemoryRange(void* data, size_t size)
+{
+	size_t pageSize = getPageSize();
+
+	// only whole pages inside the range can be discarded; the partial pages at the edges may be shared with other data
+	uintptr_t begin = (uintptr_t(data) + pageSize - 1) / pageSize * pageSize;
+	uintptr_t end = (uintptr_t(data) + size) / pageSize * pageSize;
+
+	if (begin >= end)
+		return;
+
+#ifdef _WIN32
+	// MEM_RESET keeps the pages committed but lets the system drop them without writing them to the paging file
+	VirtualAlloc(reinterpret_cast<void*>(begin), end - begin, MEM_RESET, PAGE_READWRITE);
+	VirtualUnlock(reinterpret_cast<void*>(begin), end - begin);
+#else
+	madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+#endif
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct MappedFile {
+	void* data;
+	size_t size;
+
+	void* file;
+	void* mapping;
+};
+
+bool mapFile(MappedFile& result, const char* path);
+void unmapFile(MappedFile& file);
+
+// Size and last write time of a file without opening it; time is in platform units and only meant for comparisons
+bool getFileInfo(const char* path, uint64_t& size, uint64_t& time);
+
+// Drops the pages of a range from the working set; contents stay valid and are paged back in from the file on access
+void releaseFileRange(const MappedFile& file, size_t offset, size_t size);
+
+// Returns the pages of a heap range that will not be read again to the system; contents of the range become undefined
+void discardMemoryRange(void* data, size_t size);
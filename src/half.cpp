@@ -0,0 +1,275 @@
+#include "common.h"
+#include "half.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HALF_X86 1
+#endif
+
+#ifdef HALF_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define HALF_TARGET_F16C
+#else
+#include <cpuid.h>
+#define HALF_TARGET_F16C __attribute__((target("avx,f16c")))
+#endif
+
+#include <immintrin.h>
+#endif
+
+static uint32_t asUint(float v)
+{
+	uint32_t u;
+	memcpy(&u, &v, 4);
+	return u;
+}
+
+static float asFloat(uint32_t u)
+{
+	float v;
+	memcpy(&v, &u, 4);
+	return v;
+}
+
+// Denormal results are produced by an fp32 add that aligns the mantissa, which rounds to nearest even for free
+uint16_t floatToHalf(float v)
+{
+	const uint32_t infinity = 255 << 23;
+	const uint32_t overflow = (127 + 16) << 23;
+	const uint32_t minNormal = (127 - 14) << 23;
+	const uint32_t denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+	uint32_t u = asUint(v);
+	uint32_t sign = u & 0x80000000;
+	u ^= sign;
+
+	uint32_t h;
+
+	if (u >= overflow) {
+		h = u > infinity ? 0x7e00 : 0x7c00;
+	}
+	else if (u < minNormal) {
+		h = asUint(asFloat(u) + asFloat(denormMagic)) - denormMagic;
+	}
+	else {
+		uint32_t mantOdd = (u >> 13) & 1;
+
+		// rebias exponent and round; the odd bit turns round-half-up into round-half-even
+		u += (uint32_t(15 - 127) << 23) + 0xfff;
+		u += mantOdd;
+		h = u >> 13;
+	}
+
+	return uint16_t(h | (sign >> 16));
+}
+
+// Scaling by 2^112 rebiases the exponent and turns half denormals into fp32 normals
+float halfToFloat(uint16_t v)
+{
+	const float magic = asFloat((254 - 15) << 23);
+
+	uint32_t expmant = v & 0x7fff;
+	uint32_t sign = uint32_t(v & 0x8000) << 16;
+
+	uint32_t u = asUint(asFloat(expmant << 13) * magic);
+
+	if (expmant >= 0x7c00)
+		u |= 255 << 23;
+
+	return asFloat(u | sign);
+}
+
+static void convertFloatToHalfScalar(uint16_t* destination, const float* source, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		destination[i] = floatToHalf(source[i]);
+}
+
+static void convertHalfToFloatScalar(float* destination, const uint16_t* source, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		destination[i] = halfToFloat(source[i]);
+}
+
+#ifdef HALF_X86
+// Same algorithm as floatToHalf, branchless over 4 lanes
+static __m128i floatToHalf4(__m128 v)
+{
+	const __m128i overflow = _mm_set1_epi32((127 + 16) << 23);
+	const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23);
+	const __m128i denormMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+	const __m128i normalBias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+	__m128 sign = _mm_and_ps(v, _mm_set1_ps(-0.f));
+	__m128 absv = _mm_xor_ps(v, sign);
+	__m128i absu = _mm_castps_si128(absv);
+
+	__m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(absv, absv));
+	__m128i isRegular = _mm_cmpgt_epi32(overflow, absu);
+	__m128i isDenorm = _mm_cmpgt_epi32(minNormal, absu);
+
+	__m128i special = _mm_or_si128(_mm_and_si128(isNaN, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+	__m128i denorm = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absv, _mm_castsi128_ps(denormMagic))), denormMagic);
+
+	__m128i mantOdd = _mm_srai_epi32(_mm_slli_epi32(absu, 31 - 13), 31);
+	__m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absu, normalBias), mantOdd), 13);
+
+	__m128i finite = _mm_or_si128(_mm_and_si128(isDenorm, denorm), _mm_andnot_si128(isDenorm, normal));
+	__m128i result = _mm_or_si128(_mm_and_si128(isRegular, finite), _mm_andnot_si128(isRegular, special));
+
+	// sign is shifted arithmetically so that every lane stays in int16 range for the saturating pack
+	return _mm_or_si128(result, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+
+// Same algorithm as halfToFloat; h holds one half per 32-bit lane
+static __m128 halfToFloat4(__m128i h)
+{
+	const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+
+	__m128i expmant = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+	__m128i sign = _mm_slli_epi32(_mm_xor_si128(h, expmant), 16);
+
+	__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expmant, 13)), magic);
+
+	__m128i isInfNaN = _mm_cmpgt_epi32(expmant, _mm_set1_epi32(0x7bff));
+	__m128i infNaNExp = _mm_and_si128(isInfNaN, _mm_set1_epi32(255 << 23));
+
+	return _mm_or_ps(scaled, _mm_castsi128_ps(_mm_or_si128(sign, infNaNExp)));
+}
+
+static void convertFloatToHalfSSE2(uint16_t* destination, const float* source, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i h0 = floatToHalf4(_mm_loadu_ps(source + i));
+		__m128i h1 = floatToHalf4(_mm_loadu_ps(source + i + 4));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_packs_epi32(h0, h1));
+	}
+
+	convertFloatToHalfScalar(destination + i, source + i, count - i);
+}
+
+static void convertHalfToFloatSSE2(float* destination, const uint16_t* source, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+
+		_mm_storeu_ps(destination + i, halfToFloat4(_mm_unpacklo_epi16(h, _mm_setzero_si128())));
+		_mm_storeu_ps(destination + i + 4, halfToFloat4(_mm_unpackhi_epi16(h, _mm_setzero_si128())));
+	}
+
+	convertHalfToFloatScalar(destination + i, source + i, count - i);
+}
+
+HALF_TARGET_F16C static void convertFloatToHalfF16C(uint16_t* destination, const float* source, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(source + i), _MM_FROUND_TO_NEAREST_INT);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), h);
+	}
+
+	convertFloatToHalfScalar(destination + i, source + i, count - i);
+}
+
+HALF_TARGET_F16C static void convertHalfToFloatF16C(float* destination, const uint16_t* source, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+
+		_mm256_storeu_ps(destination + i, _mm256_cvtph_ps(h));
+	}
+
+	convertHalfToFloatScalar(destination + i, source + i, count - i);
+}
+
+static bool hasF16C()
+{
+	int cpuinfo[4] = {};
+#ifdef _MSC_VER
+	__cpuid(cpuinfo, 1);
+#else
+	__cpuid(1, cpuinfo[0], cpuinfo[1], cpuinfo[2], cpuinfo[3]);
+#endif
+
+	bool osxsave = (cpuinfo[2] & (1 << 27)) != 0;
+	bool avx = (cpuinfo[2] & (1 << 28)) != 0;
+	bool f16c = (cpuinfo[2] & (1 << 29)) != 0;
+
+	if (!osxsave || !avx || !f16c)
+		return false;
+
+	// 256-bit conversions need the OS to preserve YMM state across context switches
+#ifdef _MSC_VER
+	uint64_t xcr0 = _xgetbv(0);
+#else
+	uint32_t xcr0lo, xcr0hi;
+	__asm__("xgetbv" : "=a"(xcr0lo), "=d"(xcr0hi) : "c"(0));
+	uint64_t xcr0 = xcr0lo | (uint64_t(xcr0hi) << 32);
+#endif
+
+	return (xcr0 & 6) == 6;
+}
+#endif
+
+static HalfConversion detectHalfConversion()
+{
+#ifdef HALF_X86
+	return hasF16C() ? HalfConversion_F16C : HalfConversion_SSE2;
+#else
+	return HalfConversion_Scalar;
+#endif
+}
+
+// dynamic initialization, so conversions from static initializers in other files that run before it take the scalar path
+static HalfConversion gHalfConversion = detectHalfConversion();
+
+void convertFloatToHalf(uint16_t* destination, const float* source, size_t count)
+{
+	switch (gHalfConversion) {
+#ifdef HALF_X86
+	case HalfConversion_F16C:
+		return convertFloatToHalfF16C(destination, source, count);
+	case HalfConversion_SSE2:
+		return convertFloatToHalfSSE2(destination, source, count);
+#endif
+	default:
+		return convertFloatToHalfScalar(destination, source, count);
+	}
+}
+
+void convertHalfToFloat(float* destination, const uint16_t* source, size_t count)
+{
+	switch (gHalfConversion) {
+#ifdef HALF_X86
+	case HalfConversion_F16C:
+		return convertHalfToFloatF16C(destination, source, count);
+	case HalfConversion_SSE2:
+		return convertHalfToFloatSSE2(destination, source, count);
+#endif
+	default:
+		return convertHalfToFloatScalar(destination, source, count);
+	}
+}
+
+HalfConversion getHalfConversion()
+{
+	return gHalfConversion;
+}
+
+void setHalfConversion(HalfConversion conversion)
+{
+	// requesting a path the CPU lacks falls back to the best supported one
+	gHalfConversion = conversion < detectHalfConversion() ? conversion : detectHalfConversion();
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum HalfConversion {
+	HalfConversion_Scalar,
+	HalfConversion_SSE2,
+	HalfConversion_F16C,
+};
+
+// Conversions round to nearest even and preserve denormals; all paths produce identical results for non-NaN inputs
+uint16_t floatToHalf(float v);
+float halfToFloat(uint16_t v);
+
+void convertFloatToHalf(uint16_t* destination, const float* source, size_t count);
+void convertHalfToFloat(float* destination, const uint16_t* source, size_t count);
+
+// The fastest path supported by the CPU is selected by a static initializer when the program loads; benchmarks can force a slower one
+HalfConversion getHalfConversion();
+void setHalfConversion(HalfConversion conversion);
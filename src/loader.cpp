@@ -0,0 +1,88 @@
+#include "common.h"
+#include "mesh.h"
+#include "scene.h"
+#include "loader.h"
+#include "meshcache.h"
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include <GLFW/glfw3.h>
+
+// Small enough that one chunk never holds up a frame for long, large enough that per-chunk upload overhead does not matter
+const size_t kChunkTriangles = 64 * 1024;
+
+static bool pushChunk(MeshLoader& loader, MeshChunk&& chunk)
+{
+	// the render loop drains the queue every frame, so a full queue only means that uploads are behind
+	while (!loader.chunks.push(std::move(chunk))) {
+		if (loader.cancelled)
+			return false;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return true;
+}
+
+static void loadMeshes(MeshLoader& loader, std::vector<const char*> paths, uint32_t cacheOptions, MeshletLimits meshletLimits, bool lowMemory)
+{
+	for (const char* path : paths) {
+		if (loader.cancelled)
+			break;
+
+		double startTime = glfwGetTime();
+
+		std::shared_ptr<const MeshData> data;
+
+		if (loadMeshCache(data, path, cacheOptions, meshletLimits)) {
+			printf("Loaded %s from cache in %.2f ms\n", path, (glfwGetTime() - startTime) * 1000.0);
+		}
+		else {
+			std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+
+			// loadMesh reports the error; the remaining meshes are still worth showing
+			if (!loadMesh(*mesh, path, lowMemory))
+				continue;
+
+			buildMeshLods(*mesh);
+
+			if (cacheOptions & MeshCache_Meshlets) {
+				buildMeshlets(*mesh, (cacheOptions & MeshCache_GreedyMeshlets) ? MeshletBuilder_Greedy : MeshletBuilder_Meshopt, meshletLimits);
+				buildMeshletBounds(*mesh);
+			}
+
+			printf("Loaded %s in %.2f ms\n", path, (glfwGetTime() - startTime) * 1000.0);
+
+			saveMeshCache(*mesh, path, cacheOptions, meshletLimits);
+
+			data = makeMeshData(mesh);
+		}
+
+		// the chunks keep the mesh, or the mapped cache, alive until the render loop has appended the last of them
+		std::vector<MeshChunk> meshChunks;
+		splitMesh(meshChunks, data, kChunkTriangles);
+
+		data.reset();
+
+		for (MeshChunk& chunk : meshChunks)
+			if (!pushChunk(loader, std::move(chunk)))
+				return;
+	}
+
+	loader.done = true;
+}
+
+void startMeshLoader(MeshLoader& loader, const std::vector<const char*>& paths, uint32_t cacheOptions, MeshletLimits meshletLimits, bool lowMemory)
+{
+	loader.thread = std::thread(loadMeshes, std::ref(loader), paths, cacheOptions, meshletLimits, lowMemory);
+}
+
+void stopMeshLoader(MeshLoader& loader)
+{
+	loader.cancelled = true;
+
+	if (loader.thread.joinable())
+		loader.thread.join();
+}
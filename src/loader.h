@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+
+#include "parallel.h"
+#include "scene.h"
+
+// Loads meshes on a background thread and hands them to the render loop chunk by chunk through a lock-free queue
+struct MeshLoader {
+	SpscQueue<MeshChunk, 64> chunks;
+
+	std::atomic<bool> done{ false }; // set once every chunk has been pushed
+	std::atomic<bool> cancelled{ false };
+
+	std::thread thread;
+};
+
+// Meshes are loaded in order, from the mesh cache when possible; meshlets are built with meshletLimits when cacheOptions asks for them
+void startMeshLoader(MeshLoader& loader, const std::vector<const char*>& paths, uint32_t cacheOptions, MeshletLimits meshletLimits, bool lowMemory);
+
+// Cancels loading if it is still running and waits for the thread; a mesh that is being loaded is finished first
+void stopMeshLoader(MeshLoader& loader);
@@ -0,0 +1,1129 @@
+#include "common.h"
+#include "mesh.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "objparser.h"
+#include "fileio.h"
+#include "parallel.h"
+#include "half.h"
+#include "vertexformat.h"
+
+#include <meshoptimizer.h>
+
+#define CGLTF_IMPLEMENTATION
+#include <cgltf.h>
+
+#include <algorithm>
+#include <string>
+
+// Positions and texcoords of an ObjFile encoded for the vertex format; attributes are shared by many face corners so they are encoded once up front
+struct ObjEncodedAttributes {
+	std::vector<VertexEncoder::Position> positions;
+	std::vector<VertexEncoder::Texcoord> texcoords;
+};
+
+static void setPositionBounds(Mesh& mesh, const float* min, const float* max)
+{
+	float extent = std::max(max[0] - min[0], std::max(max[1] - min[1], max[2] - min[2]));
+
+	mesh.positionOffset[0] = min[0];
+	mesh.positionOffset[1] = min[1];
+	mesh.positionOffset[2] = min[2];
+	mesh.positionScale = extent / 65535.f;
+}
+
+template <typename T, typename Encode>
+static void encodeAttribute(std::vector<T>& result, std::vector<float>& source, const Encode& encode)
+{
+	// blocks are a multiple of 3 and 2 floats so that every block starts at the first component of an element
+	const size_t kBlockSize = 6 * 16384;
+
+	result.resize(source.size());
+
+	parallelFor((source.size() + kBlockSize - 1) / kBlockSize, [&](size_t block) {
+		size_t begin = block * kBlockSize;
+		size_t count = std::min(kBlockSize, source.size() - begin);
+
+		encode(&result[begin], &source[begin], count);
+	});
+
+	// the float data is not needed past this point, releasing it keeps peak memory flat
+	source = std::vector<float>();
+}
+
+static void encodeAttributes(ObjEncodedAttributes& result, Mesh& mesh, ObjFile& obj)
+{
+	float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	// element 0 is the dummy position and does not contribute to the bounds
+	for (size_t i = 3; i < obj.positions.size(); i += 3)
+		for (int k = 0; k < 3; ++k) {
+			min[k] = std::min(min[k], obj.positions[i + k]);
+			max[k] = std::max(max[k], obj.positions[i + k]);
+		}
+
+	if (obj.positions.size() > 3)
+		setPositionBounds(mesh, min, max);
+
+	encodeAttribute(result.positions, obj.positions, [&](VertexEncoder::Position* destination, const float* source, size_t count) {
+		VertexEncoder::encodePositions(destination, source, count, mesh);
+	});
+
+	encodeAttribute(result.texcoords, obj.texcoords, [&](VertexEncoder::Texcoord* destination, const float* source, size_t count) {
+		VertexEncoder::encodeTexcoords(destination, source, count);
+	});
+}
+
+static Vertex makeVertex(const ObjFile& obj, const ObjEncodedAttributes& attributes, ObjIndex gi)
+{
+	return VertexEncoder::makeVertex(&attributes.positions[gi.p * 3], &obj.normals[gi.n * 3], &attributes.texcoords[gi.t * 2]);
+}
+
+static void triangulateFaces(Vertex* vertices, const ObjFile& obj, const ObjEncodedAttributes& attributes, size_t face_begin, size_t face_end, size_t index_offset, size_t vertex_offset)
+{
+	for (size_t i = face_begin; i < face_end; ++i)
+	{
+		unsigned int face_vertices = obj.faceVertices[i];
+
+		// degenerate faces are skipped, consistently with the offsets computed in loadMesh
+		if (face_vertices < 3)
+		{
+			index_offset += face_vertices;
+			continue;
+		}
+
+		for (unsigned int j = 0; j < face_vertices; ++j)
+		{
+			Vertex v = makeVertex(obj, attributes, obj.indices[index_offset + j]);
+
+			// triangulate polygon on the fly; offset-3 is always the first polygon vertex
+			if (j >= 3)
+			{
+				vertices[vertex_offset + 0] = vertices[vertex_offset - 3];
+				vertices[vertex_offset + 1] = vertices[vertex_offset - 1];
+				vertex_offset += 2;
+			}
+
+			vertices[vertex_offset] = v;
+			vertex_offset++;
+		}
+
+		index_offset += face_vertices;
+	}
+}
+
+// Builds the unindexed triangle stream in parallel and indexes it with meshopt_generateVertexRemap
+static void indexFaces(Mesh& result, ObjFile& obj, const ObjEncodedAttributes& attributes)
+{
+	// faces are triangulated in blocks; per-block offsets let every block write its part of the stream independently
+	const size_t kFaceBlockSize = 16384;
+
+	size_t face_count = obj.faceVertices.size();
+	size_t block_count = (face_count + kFaceBlockSize - 1) / kFaceBlockSize;
+
+	std::vector<size_t> block_index_offsets(block_count + 1);
+	std::vector<size_t> block_vertex_offsets(block_count + 1);
+
+	parallelFor(block_count, [&](size_t block) {
+		size_t face_end = std::min(face_count, (block + 1) * kFaceBlockSize);
+
+		size_t index_count = 0;
+		size_t vertex_count = 0;
+
+		for (size_t i = block * kFaceBlockSize; i < face_end; ++i)
+		{
+			index_count += obj.faceVertices[i];
+			vertex_count += obj.faceVertices[i] >= 3 ? 3 * (obj.faceVertices[i] - 2) : 0;
+		}
+
+		block_index_offsets[block + 1] = index_count;
+		block_vertex_offsets[block + 1] = vertex_count;
+	});
+
+	for (size_t block = 0; block < block_count; ++block)
+	{
+		block_index_offsets[block + 1] += block_index_offsets[block];
+		block_vertex_offsets[block + 1] += block_vertex_offsets[block];
+	}
+
+	size_t total_indices = block_vertex_offsets[block_count];
+
+	std::vector<Vertex> vertices(total_indices);
+
+	parallelFor(block_count, [&](size_t block) {
+		size_t face_end = std::min(face_count, (block + 1) * kFaceBlockSize);
+
+		triangulateFaces(vertices.data(), obj, attributes, block * kFaceBlockSize, face_end, block_index_offsets[block], block_vertex_offsets[block]);
+	});
+
+	obj = ObjFile();
+
+	std::vector<unsigned int> remap(total_indices);
+
+	size_t total_vertices = meshopt_generateVertexRemap(&remap[0], NULL, total_indices, &vertices[0], total_indices, sizeof(Vertex));
+
+	result.indices.resize(total_indices);
+	meshopt_remapIndexBuffer(&result.indices[0], NULL, total_indices, &remap[0]);
+
+	result.vertices.resize(total_vertices);
+	meshopt_remapVertexBuffer(&result.vertices[0], &vertices[0], total_indices, sizeof(Vertex), &remap[0]);
+}
+
+static uint32_t hashVertex(const Vertex& v)
+{
+	static_assert(sizeof(Vertex) % 4 == 0, "Vertex is hashed as a sequence of 32-bit words");
+
+	const unsigned int m = 0x5bd1e995;
+	const int r = 24;
+
+	const char* data = reinterpret_cast<const char*>(&v);
+	uint32_t h = 0;
+
+	// MurmurHash2 mixing, same as the vertex hasher in meshopt_generateVertexRemap
+	for (size_t i = 0; i < sizeof(Vertex); i += 4)
+	{
+		uint32_t k;
+		memcpy(&k, data + i, 4);
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h *= m;
+		h ^= k;
+	}
+
+	return h;
+}
+
+static void rehashVertices(std::vector<uint32_t>& table, const std::vector<Vertex>& vertices)
+{
+	std::fill(table.begin(), table.end(), ~0u);
+
+	size_t mask = table.size() - 1;
+
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		size_t bucket = hashVertex(vertices[i]) & mask;
+
+		// vertices are unique so there is no need to compare, only to find a free slot
+		for (size_t probe = 0; table[bucket] != ~0u; ++probe)
+			bucket = (bucket + probe + 1) & mask;
+
+		table[bucket] = uint32_t(i);
+	}
+}
+
+static uint32_t weldVertex(std::vector<uint32_t>& table, std::vector<Vertex>& vertices, const Vertex& v)
+{
+	// keep load factor under 50% so that probe sequences stay short
+	if (vertices.size() * 2 >= table.size())
+	{
+		table.resize(table.size() * 2);
+		rehashVertices(table, vertices);
+	}
+
+	size_t mask = table.size() - 1;
+	size_t bucket = hashVertex(v) & mask;
+
+	for (size_t probe = 0; table[bucket] != ~0u; ++probe)
+	{
+		uint32_t index = table[bucket];
+
+		if (memcmp(&vertices[index], &v, sizeof(Vertex)) == 0)
+			return index;
+
+		bucket = (bucket + probe + 1) & mask;
+	}
+
+	uint32_t index = uint32_t(vertices.size());
+	table[bucket] = index;
+	vertices.push_back(v);
+
+	return index;
+}
+
+// Welds vertices through a hash table while triangulating, so neither the unindexed stream nor the remap table is ever allocated
+// Vertices are numbered in order of first occurrence, which is what meshopt_generateVertexRemap produces, so the result matches indexFaces
+static void weldFaces(Mesh& result, ObjFile& obj, const ObjEncodedAttributes& attributes)
+{
+	size_t total_indices = 0;
+
+	for (uint32_t face_vertices : obj.faceVertices)
+		total_indices += face_vertices >= 3 ? 3 * (face_vertices - 2) : 0;
+
+	// the final vertex count is unknown up front; the largest attribute count is a good lower bound for typical meshes
+	size_t expected_vertices = std::max(attributes.positions.size() / 3, std::max(attributes.texcoords.size() / 2, obj.normals.size() / 3));
+
+	size_t table_size = 1;
+	while (table_size < expected_vertices * 2)
+		table_size *= 2;
+
+	std::vector<uint32_t> table(table_size, ~0u);
+
+	result.vertices.clear();
+	result.vertices.reserve(expected_vertices);
+
+	result.indices.resize(total_indices);
+
+	// face data is read once front to back, so consumed blocks are discarded as welding proceeds to keep the peak flat
+	const size_t kFaceBlockSize = 65536;
+
+	size_t index_offset = 0;
+	size_t vertex_offset = 0;
+
+	size_t discarded_faces = 0;
+	size_t discarded_indices = 0;
+
+	for (size_t i = 0; i < obj.faceVertices.size(); ++i)
+	{
+		uint32_t face_vertices = obj.faceVertices[i];
+
+		if (i - discarded_faces == kFaceBlockSize)
+		{
+			discardMemoryRange(&obj.faceVertices[discarded_faces], (i - discarded_faces) * sizeof(uint32_t));
+			discardMemoryRange(&obj.indices[discarded_indices], (index_offset - discarded_indices) * sizeof(ObjIndex));
+
+			discarded_faces = i;
+			discarded_indices = index_offset;
+		}
+
+		if (face_vertices < 3)
+		{
+			index_offset += face_vertices;
+			continue;
+		}
+
+		uint32_t first = 0;
+		uint32_t last = 0;
+
+		for (unsigned int j = 0; j < face_vertices; ++j)
+		{
+			uint32_t index = weldVertex(table, result.vertices, makeVertex(obj, attributes, obj.indices[index_offset + j]));
+
+			// same fan triangulation as triangulateFaces
+			if (j >= 3)
+			{
+				result.indices[vertex_offset + 0] = first;
+				result.indices[vertex_offset + 1] = last;
+				vertex_offset += 2;
+			}
+
+			result.indices[vertex_offset] = index;
+			vertex_offset++;
+
+			first = (j == 0) ? index : first;
+			last = index;
+		}
+
+		index_offset += face_vertices;
+	}
+
+	obj = ObjFile();
+	table = std::vector<uint32_t>();
+
+	result.vertices.shrink_to_fit();
+}
+
+// Calls body with every decoded position; positions are decoded in batches so that huge meshes never need a float copy of every position
+template <typename Body>
+static void forEachPosition(const Mesh& mesh, const Body& body)
+{
+	const size_t kBatchSize = 1024;
+
+	VertexEncoder::Position encodedPositions[kBatchSize][3];
+	float positions[kBatchSize][3];
+
+	for (size_t begin = 0; begin < mesh.vertices.size(); begin += kBatchSize) {
+		size_t count = std::min(kBatchSize, mesh.vertices.size() - begin);
+
+		for (size_t i = 0; i < count; ++i)
+			memcpy(encodedPositions[i], &mesh.vertices[begin + i].vx, sizeof(encodedPositions[i]));
+
+		VertexEncoder::decodePositions(&positions[0][0], &encodedPositions[0][0], count * 3, mesh);
+
+		for (size_t i = 0; i < count; ++i)
+			body(positions[i]);
+	}
+}
+
+// Sphere around the bounding box; not minimal, but two cheap passes even on huge meshes
+static void computeMeshBounds(Mesh& mesh)
+{
+	float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	forEachPosition(mesh, [&](const float* p) {
+		for (int k = 0; k < 3; ++k) {
+			min[k] = std::min(min[k], p[k]);
+			max[k] = std::max(max[k], p[k]);
+		}
+	});
+
+	float center[3] = { (min[0] + max[0]) * 0.5f, (min[1] + max[1]) * 0.5f, (min[2] + max[2]) * 0.5f };
+	float radius = 0.f;
+
+	forEachPosition(mesh, [&](const float* p) {
+		float dx = p[0] - center[0], dy = p[1] - center[1], dz = p[2] - center[2];
+		radius = std::max(radius, dx * dx + dy * dy + dz * dz);
+	});
+
+	memcpy(mesh.center, center, sizeof(center));
+	mesh.radius = sqrtf(radius);
+}
+
+static void optimizeMesh(Mesh& result)
+{
+	size_t total_indices = result.indices.size();
+	size_t total_vertices = result.vertices.size();
+
+	meshopt_optimizeVertexCache(result.indices.data(), result.indices.data(), total_indices, total_vertices);
+	meshopt_optimizeVertexFetch(result.vertices.data(), result.indices.data(), total_indices, result.vertices.data(), total_vertices, sizeof(Vertex));
+
+	MeshLod lod = {};
+	lod.indexCount = uint32_t(total_indices);
+
+	result.lods.assign(1, lod);
+	computeMeshBounds(result);
+}
+
+static bool hasExtension(const char* path, const char* ext)
+{
+	size_t length = strlen(path);
+	size_t extLength = strlen(ext);
+
+	return length >= extLength && strcmp(path + length - extLength, ext) == 0;
+}
+
+bool loadMesh(Mesh& result, const char* path, bool lowMemory)
+{
+	// glTF attributes are read in place from the mapped file, so there is no separate low memory mode for them
+	if (hasExtension(path, ".gltf") || hasExtension(path, ".glb"))
+		return loadMeshGltf(result, path);
+
+	ObjFile obj;
+	if (!parseObj(obj, path, 0, lowMemory))
+	{
+		printf("Error loading %s: file not found\n", path);
+		return false;
+	}
+
+	ObjEncodedAttributes attributes;
+	encodeAttributes(attributes, result, obj);
+
+	if (lowMemory)
+		weldFaces(result, obj, attributes);
+	else
+		indexFaces(result, obj, attributes);
+
+	optimizeMesh(result);
+
+	return true;
+}
+
+// Maps external .bin buffers next to the .gltf file; buffers embedded as data URIs are left to cgltf_load_buffers
+static bool mapGltfBuffers(cgltf_data* data, const char* path, std::vector<MappedFile>& files)
+{
+	const char* slash = strrchr(path, '/');
+	const char* backslash = strrchr(path, '\\');
+	const char* base = std::max(slash ? slash + 1 : path, backslash ? backslash + 1 : path);
+
+	for (size_t i = 0; i < data->buffers_count; ++i)
+	{
+		cgltf_buffer& buffer = data->buffers[i];
+
+		if (buffer.data || !buffer.uri || strncmp(buffer.uri, "data:", 5) == 0 || strstr(buffer.uri, "://"))
+			continue;
+
+		std::string uri = buffer.uri;
+		uri.resize(cgltf_decode_uri(&uri[0]));
+
+		std::string bufferPath = std::string(path, base) + uri;
+
+		MappedFile file;
+		if (!mapFile(file, bufferPath.c_str()))
+			return false;
+
+		files.push_back(file);
+
+		if (file.size < buffer.size)
+			return false;
+
+		buffer.data = file.data;
+		buffer.data_free_method = cgltf_data_free_method_none;
+	}
+
+	return true;
+}
+
+// Decodes EXT_meshopt_compression buffer views; decoded data is owned by the view and released by cgltf_free
+static bool decodeGltfMeshopt(cgltf_data* data)
+{
+	for (size_t i = 0; i < data->buffer_views_count; ++i)
+	{
+		cgltf_buffer_view& view = data->buffer_views[i];
+
+		if (!view.has_meshopt_compression)
+			continue;
+
+		const cgltf_meshopt_compression& mc = view.meshopt_compression;
+
+		const unsigned char* source = static_cast<const unsigned char*>(mc.buffer->data);
+		if (!source)
+			return false;
+
+		source += mc.offset;
+
+		void* decoded = malloc(mc.count * mc.stride);
+		if (!decoded)
+			return false;
+
+		view.data = decoded;
+
+		int rc = -1;
+
+		switch (mc.mode)
+		{
+		case cgltf_meshopt_compression_mode_attributes:
+			rc = meshopt_decodeVertexBuffer(decoded, mc.count, mc.stride, source, mc.size);
+			break;
+
+		case cgltf_meshopt_compression_mode_triangles:
+			rc = meshopt_decodeIndexBuffer(decoded, mc.count, mc.stride, source, mc.size);
+			break;
+
+		case cgltf_meshopt_compression_mode_indices:
+			rc = meshopt_decodeIndexSequence(decoded, mc.count, mc.stride, source, mc.size);
+			break;
+
+		default:
+			return false;
+		}
+
+		if (rc != 0)
+			return false;
+
+		switch (mc.filter)
+		{
+		case cgltf_meshopt_compression_filter_octahedral:
+			meshopt_decodeFilterOct(decoded, mc.count, mc.stride);
+			break;
+
+		case cgltf_meshopt_compression_filter_quaternion:
+			meshopt_decodeFilterQuat(decoded, mc.count, mc.stride);
+			break;
+
+		case cgltf_meshopt_compression_filter_exponential:
+			meshopt_decodeFilterExp(decoded, mc.count, mc.stride);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return true;
+}
+
+// Reads accessor elements as floats; plain float data is read straight from the mapped (or decoded) buffer view
+struct GltfAttribute {
+	const cgltf_accessor* accessor;
+	const uint8_t* data;
+	size_t stride;
+
+	GltfAttribute(const cgltf_accessor* accessor)
+		: accessor(accessor)
+		, data(0)
+		, stride(0)
+	{
+		if (accessor && accessor->buffer_view && !accessor->is_sparse && !accessor->normalized && accessor->component_type == cgltf_component_type_r_32f) {
+			const uint8_t* view = cgltf_buffer_view_data(accessor->buffer_view);
+
+			data = view ? view + accessor->offset : 0;
+			stride = accessor->stride;
+		}
+	}
+
+	void read(size_t index, float* result, size_t count) const
+	{
+		if (data)
+			memcpy(result, data + index * stride, count * sizeof(float));
+		else
+			cgltf_accessor_read_float(accessor, index, result, count);
+	}
+};
+
+static void transformPosition(float* result, const float* m, const float* p)
+{
+	float x = p[0], y = p[1], z = p[2];
+
+	result[0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+	result[1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+	result[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+}
+
+static void transformNormal(float* result, const float* n, const float* n0)
+{
+	float x = n0[0], y = n0[1], z = n0[2];
+
+	float rx = n[0] * x + n[3] * y + n[6] * z;
+	float ry = n[1] * x + n[4] * y + n[7] * z;
+	float rz = n[2] * x + n[5] * y + n[8] * z;
+
+	float length = sqrtf(rx * rx + ry * ry + rz * rz);
+	float invlength = length == 0.f ? 0.f : 1 / length;
+
+	result[0] = rx * invlength;
+	result[1] = ry * invlength;
+	result[2] = rz * invlength;
+}
+
+static void expandGltfBounds(float* min, float* max, const cgltf_primitive& primitive, const float* world)
+{
+	const cgltf_accessor* positions = cgltf_find_accessor(&primitive, cgltf_attribute_type_position, 0);
+	if (primitive.type != cgltf_primitive_type_triangles || !positions)
+		return;
+
+	GltfAttribute position(positions);
+
+	for (size_t i = 0; i < positions->count; ++i)
+	{
+		float p[3];
+		position.read(i, p, 3);
+		transformPosition(p, world, p);
+
+		for (int k = 0; k < 3; ++k)
+		{
+			min[k] = std::min(min[k], p[k]);
+			max[k] = std::max(max[k], p[k]);
+		}
+	}
+}
+
+static bool appendGltfPrimitive(Mesh& result, const cgltf_primitive& primitive, const float* world)
+{
+	const cgltf_accessor* positions = cgltf_find_accessor(&primitive, cgltf_attribute_type_position, 0);
+	if (primitive.type != cgltf_primitive_type_triangles || !positions)
+		return true;
+
+	// normals transform by the cofactor matrix (inverse transpose up to scale), which handles non-uniform scale
+	const float* m = world;
+	float normalMatrix[9] =
+	{
+		m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8],
+		m[9] * m[2] - m[10] * m[1], m[10] * m[0] - m[8] * m[2], m[8] * m[1] - m[9] * m[0],
+		m[1] * m[6] - m[2] * m[5], m[2] * m[4] - m[0] * m[6], m[0] * m[5] - m[1] * m[4],
+	};
+
+	// mirroring transforms flip the winding, which would make the triangles back-facing
+	float det = m[0] * normalMatrix[0] + m[4] * normalMatrix[1] + m[8] * normalMatrix[2];
+
+	GltfAttribute position(positions);
+	GltfAttribute normal(cgltf_find_accessor(&primitive, cgltf_attribute_type_normal, 0));
+	GltfAttribute texcoord(cgltf_find_accessor(&primitive, cgltf_attribute_type_texcoord, 0));
+
+	size_t vertex_offset = result.vertices.size();
+	size_t vertex_count = positions->count;
+
+	result.vertices.resize(vertex_offset + vertex_count);
+
+	// vertices are converted in batches so that the float to half conversion runs over arrays without staging the whole primitive;
+	// normals are quantized per vertex by makeVertex, so they go straight from the accessor into it
+	const size_t kBatchSize = 1024;
+
+	float p[kBatchSize][3];
+	float t[kBatchSize][2] = {};
+
+	VertexEncoder::Position ep[kBatchSize][3];
+	VertexEncoder::Texcoord et[kBatchSize][2];
+
+	for (size_t begin = 0; begin < vertex_count; begin += kBatchSize)
+	{
+		size_t count = std::min(kBatchSize, vertex_count - begin);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			position.read(begin + i, p[i], 3);
+			transformPosition(p[i], world, p[i]);
+
+			if (texcoord.accessor)
+				texcoord.read(begin + i, t[i], 2);
+		}
+
+		VertexEncoder::encodePositions(&ep[0][0], &p[0][0], count * 3, result);
+		VertexEncoder::encodeTexcoords(&et[0][0], &t[0][0], count * 2);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			float n[3] = { 0.f, 0.f, 1.f };
+
+			if (normal.accessor)
+			{
+				normal.read(begin + i, n, 3);
+				transformNormal(n, normalMatrix, n);
+			}
+
+			result.vertices[vertex_offset + begin + i] = VertexEncoder::makeVertex(ep[i], n, et[i]);
+		}
+	}
+
+	size_t index_offset = result.indices.size();
+	size_t index_count = primitive.indices ? primitive.indices->count : vertex_count;
+
+	index_count -= index_count % 3;
+
+	result.indices.resize(index_offset + index_count);
+
+	for (size_t i = 0; i < index_count; i += 3)
+	{
+		size_t a = primitive.indices ? cgltf_accessor_read_index(primitive.indices, i + 0) : i + 0;
+		size_t b = primitive.indices ? cgltf_accessor_read_index(primitive.indices, i + 1) : i + 1;
+		size_t c = primitive.indices ? cgltf_accessor_read_index(primitive.indices, i + 2) : i + 2;
+
+		// cgltf_validate checks index ranges before meshopt decompression, so decoded indices are checked here
+		if (a >= vertex_count || b >= vertex_count || c >= vertex_count)
+			return false;
+
+		if (det < 0.f)
+			std::swap(b, c);
+
+		result.indices[index_offset + i + 0] = uint32_t(vertex_offset + a);
+		result.indices[index_offset + i + 1] = uint32_t(vertex_offset + b);
+		result.indices[index_offset + i + 2] = uint32_t(vertex_offset + c);
+	}
+
+	return true;
+}
+
+bool loadMeshGltf(Mesh& result, const char* path)
+{
+	MappedFile file;
+	if (!mapFile(file, path))
+	{
+		printf("Error loading %s: file not found\n", path);
+		return false;
+	}
+
+	// for .glb files cgltf keeps pointing into the mapped binary chunk, so the mapping must outlive the parsed data
+	cgltf_options options = {};
+	cgltf_data* data = 0;
+	std::vector<MappedFile> buffers;
+
+	cgltf_result res = cgltf_parse(&options, file.data, file.size, &data);
+
+	if (res == cgltf_result_success && !mapGltfBuffers(data, path, buffers))
+		res = cgltf_result_file_not_found;
+
+	res = (res == cgltf_result_success) ? cgltf_load_buffers(&options, data, path) : res;
+	res = (res == cgltf_result_success) ? cgltf_validate(data) : res;
+
+	if (res == cgltf_result_success && !decodeGltfMeshopt(data))
+		res = cgltf_result_invalid_gltf;
+
+	bool indicesValid = true;
+
+	if (res == cgltf_result_success)
+	{
+		result.vertices.clear();
+		result.indices.clear();
+
+		std::vector<float> worlds(data->nodes_count * 16);
+
+		for (size_t i = 0; i < data->nodes_count; ++i)
+			cgltf_node_transform_world(&data->nodes[i], &worlds[i * 16]);
+
+		// bounds are needed up front by formats that quantize positions relative to them
+		float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		for (size_t i = 0; i < data->nodes_count; ++i)
+			for (size_t j = 0; data->nodes[i].mesh && j < data->nodes[i].mesh->primitives_count; ++j)
+				expandGltfBounds(min, max, data->nodes[i].mesh->primitives[j], &worlds[i * 16]);
+
+		if (min[0] <= max[0])
+			setPositionBounds(result, min, max);
+
+		for (size_t i = 0; i < data->nodes_count && indicesValid; ++i)
+			for (size_t j = 0; data->nodes[i].mesh && j < data->nodes[i].mesh->primitives_count && indicesValid; ++j)
+				indicesValid = appendGltfPrimitive(result, data->nodes[i].mesh->primitives[j], &worlds[i * 16]);
+	}
+
+	if (data)
+		cgltf_free(data);
+
+	for (MappedFile& buffer : buffers)
+		unmapFile(buffer);
+
+	unmapFile(file);
+
+	if (res != cgltf_result_success)
+	{
+		printf("Error loading %s: invalid glTF (error %d)\n", path, int(res));
+		return false;
+	}
+
+	if (!indicesValid)
+	{
+		printf("Error loading %s: index out of range\n", path);
+		return false;
+	}
+
+	if (result.indices.empty())
+	{
+		printf("Error loading %s: no triangle meshes\n", path);
+		return false;
+	}
+
+	optimizeMesh(result);
+
+	return true;
+}
+
+// Float positions for the meshopt algorithms that need them; 3 floats per vertex
+static void decodeMeshPositions(std::vector<float>& result, const Mesh& mesh)
+{
+	size_t vertexCount = mesh.vertices.size();
+
+	std::vector<VertexEncoder::Position> encodedPositions(vertexCount * 3);
+
+	for (size_t i = 0; i < vertexCount; ++i)
+		memcpy(&encodedPositions[i * 3], &mesh.vertices[i].vx, sizeof(VertexEncoder::Position) * 3);
+
+	result.resize(vertexCount * 3);
+	VertexEncoder::decodePositions(result.data(), encodedPositions.data(), vertexCount * 3, mesh);
+}
+
+// Each level is simplified from the previous one, which is much faster than starting from the full mesh every time
+void buildMeshLods(Mesh& mesh)
+{
+	const size_t kMaxLods = 8;
+	const float kMaxError = 1e-1f; // relative to the mesh extents
+
+	assert(mesh.lods.size() == 1 && mesh.meshlets.empty());
+
+	size_t vertexCount = mesh.vertices.size();
+
+	std::vector<float> positions;
+	decodeMeshPositions(positions, mesh);
+
+	float scale = meshopt_simplifyScale(positions.data(), vertexCount, sizeof(float) * 3);
+
+	std::vector<unsigned int> lodIndices(mesh.indices.begin(), mesh.indices.end());
+	std::vector<unsigned int> nextIndices(lodIndices.size());
+
+	float lodError = 0.f;
+
+	while (mesh.lods.size() < kMaxLods) {
+		size_t targetCount = lodIndices.size() / 2 / 3 * 3;
+		float error = 0.f;
+
+		size_t count = meshopt_simplify(nextIndices.data(), lodIndices.data(), lodIndices.size(), positions.data(), vertexCount, sizeof(float) * 3, targetCount, kMaxError, 0, &error);
+
+		// the regular simplifier stalls at attribute seams and open borders; coarse levels can ignore topology instead
+		if (count > lodIndices.size() * 85 / 100)
+			count = meshopt_simplifySloppy(nextIndices.data(), lodIndices.data(), lodIndices.size(), positions.data(), vertexCount, sizeof(float) * 3, targetCount, kMaxError, &error);
+
+		// a level that barely reduces the triangle count costs memory without saving any work
+		if (count == 0 || count > lodIndices.size() * 85 / 100)
+			break;
+
+		nextIndices.resize(count);
+		meshopt_optimizeVertexCache(nextIndices.data(), nextIndices.data(), count, vertexCount);
+
+		// error is measured against the previous level, so summing keeps the bound against the full mesh conservative
+		lodError += error * scale;
+
+		MeshLod lod = {};
+		lod.indexOffset = uint32_t(mesh.indices.size());
+		lod.indexCount = uint32_t(count);
+		lod.error = lodError;
+
+		mesh.lods.push_back(lod);
+		mesh.indices.insert(mesh.indices.end(), nextIndices.begin(), nextIndices.end());
+
+		lodIndices.swap(nextIndices);
+		nextIndices.resize(lodIndices.size());
+	}
+}
+
+// Appends a meshlet header along with its vertex and triangle lists
+static void appendMeshlet(Mesh& mesh, const uint32_t* vertices, size_t vertexCount, const uint8_t* triangles, size_t triangleCount)
+{
+	assert(vertexCount <= MeshletLimits().maxVertices && triangleCount <= MeshletLimits().maxTriangles);
+
+	Meshlet meshlet = {};
+	meshlet.vertexOffset = uint32_t(mesh.meshletVertices.size());
+	meshlet.triangleOffset = uint32_t(mesh.meshletTriangles.size());
+	meshlet.vertexCount = uint8_t(vertexCount);
+	meshlet.triangleCount = uint8_t(triangleCount);
+
+	mesh.meshlets.push_back(meshlet);
+	mesh.meshletVertices.insert(mesh.meshletVertices.end(), vertices, vertices + vertexCount);
+	mesh.meshletTriangles.insert(mesh.meshletTriangles.end(), triangles, triangles + triangleCount * 3);
+
+	// keeps triangle lists word aligned, which the mesh codec relies on
+	mesh.meshletTriangles.resize((mesh.meshletTriangles.size() + 3) & ~size_t(3));
+}
+
+// Fills meshlets in index order and starts a new one whenever the current one runs out of vertices or triangles
+static void appendMeshletsGreedy(Mesh& mesh, const std::vector<uint32_t>& indices, size_t vertexCount, const MeshletLimits& limits)
+{
+	// meshlet-local index of every vertex, 0xff while it is not part of the current meshlet
+	std::vector<uint8_t> meshletVertices(vertexCount, 0xff);
+
+	uint32_t vertices[64];
+	uint8_t triangles[126 * 3];
+	size_t meshletVertexCount = 0, triangleCount = 0;
+
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		unsigned int a = indices[i + 0];
+		unsigned int b = indices[i + 1];
+		unsigned int c = indices[i + 2];
+
+		uint8_t& av = meshletVertices[a];
+		uint8_t& bv = meshletVertices[b];
+		uint8_t& cv = meshletVertices[c];
+
+		if (meshletVertexCount + (av == 0xff) + (bv == 0xff) + (cv == 0xff) > limits.maxVertices || triangleCount >= limits.maxTriangles)
+		{
+			appendMeshlet(mesh, vertices, meshletVertexCount, triangles, triangleCount);
+
+			for (size_t j = 0; j < meshletVertexCount; ++j)
+				meshletVertices[vertices[j]] = 0xff;
+
+			meshletVertexCount = 0;
+			triangleCount = 0;
+		}
+
+		if (av == 0xff)
+		{
+			av = uint8_t(meshletVertexCount);
+			vertices[meshletVertexCount++] = a;
+		}
+
+		if (bv == 0xff)
+		{
+			bv = uint8_t(meshletVertexCount);
+			vertices[meshletVertexCount++] = b;
+		}
+
+		if (cv == 0xff)
+		{
+			cv = uint8_t(meshletVertexCount);
+			vertices[meshletVertexCount++] = c;
+		}
+
+		triangles[triangleCount * 3 + 0] = av;
+		triangles[triangleCount * 3 + 1] = bv;
+		triangles[triangleCount * 3 + 2] = cv;
+		triangleCount++;
+	}
+
+	if (triangleCount)
+		appendMeshlet(mesh, vertices, meshletVertexCount, triangles, triangleCount);
+}
+
+// Grows meshlets from spatially close triangles with similar normals, which gives tighter bounds and narrower cones than index order
+static void appendMeshletsMeshopt(Mesh& mesh, const std::vector<uint32_t>& indices, const std::vector<float>& positions, const MeshletLimits& limits)
+{
+	size_t maxVertices = limits.maxVertices;
+	size_t maxTriangles = limits.maxTriangles & ~3u; // meshopt_buildMeshlets wants a multiple of 4, so meshlets that can hold 126 get 124
+	const float kConeWeight = 0.5f;
+
+	size_t maxMeshlets = meshopt_buildMeshletsBound(indices.size(), maxVertices, maxTriangles);
+
+	std::vector<meshopt_Meshlet> meshlets(maxMeshlets);
+	std::vector<unsigned int> meshletVertices(maxMeshlets * maxVertices);
+	std::vector<unsigned char> meshletTriangles(maxMeshlets * maxTriangles * 3);
+
+	size_t meshletCount = meshopt_buildMeshlets(meshlets.data(), meshletVertices.data(), meshletTriangles.data(), indices.data(), indices.size(),
+		positions.data(), positions.size() / 3, sizeof(float) * 3, maxVertices, maxTriangles, kConeWeight);
+
+	for (size_t i = 0; i < meshletCount; ++i) {
+		const meshopt_Meshlet& source = meshlets[i];
+
+		// reorders triangles and vertices inside the meshlet for better locality in the mesh shader
+		meshopt_optimizeMeshlet(&meshletVertices[source.vertex_offset], &meshletTriangles[source.triangle_offset], source.triangle_count, source.vertex_count);
+
+		appendMeshlet(mesh, &meshletVertices[source.vertex_offset], source.vertex_count, &meshletTriangles[source.triangle_offset], source.triangle_count);
+	}
+}
+
+// Renumbers the vertices referenced by source in order of first use; vertices receives the original index of every local vertex
+static void remapPartition(std::vector<uint32_t>& indices, std::vector<uint32_t>& vertices, const uint32_t* source, size_t indexCount)
+{
+	// open addressing at most half full; the table is sized by the partition, not by the mesh
+	size_t tableSize = 1;
+	while (tableSize < indexCount * 2)
+		tableSize *= 2;
+
+	std::vector<uint32_t> table(tableSize, ~0u);
+
+	indices.resize(indexCount);
+	vertices.clear();
+
+	for (size_t i = 0; i < indexCount; ++i) {
+		uint32_t v = source[i];
+
+		uint32_t hash = v * 0x9e3779b1;
+		size_t bucket = (hash ^ (hash >> 16)) & (tableSize - 1);
+
+		while (table[bucket] != ~0u && vertices[table[bucket]] != v)
+			bucket = (bucket + 1) & (tableSize - 1);
+
+		if (table[bucket] == ~0u) {
+			table[bucket] = uint32_t(vertices.size());
+			vertices.push_back(v);
+		}
+
+		indices[i] = table[bucket];
+	}
+}
+
+// Clusters one range of mesh.indices into result, which only receives meshlets and their lists
+static void buildMeshletPartition(Mesh& result, const Mesh& mesh, size_t indexOffset, size_t indexCount, MeshletBuilder builder, const MeshletLimits& limits)
+{
+	// the builders work on a compact local vertex range, so their cost and scratch memory scale with the partition rather than the whole mesh
+	std::vector<uint32_t> indices, vertices;
+	remapPartition(indices, vertices, &mesh.indices[indexOffset], indexCount);
+
+	if (builder == MeshletBuilder_Greedy) {
+		appendMeshletsGreedy(result, indices, vertices.size(), limits);
+	}
+	else {
+		std::vector<VertexEncoder::Position> encodedPositions(vertices.size() * 3);
+
+		for (size_t i = 0; i < vertices.size(); ++i)
+			memcpy(&encodedPositions[i * 3], &mesh.vertices[vertices[i]].vx, sizeof(VertexEncoder::Position) * 3);
+
+		std::vector<float> positions(vertices.size() * 3);
+		VertexEncoder::decodePositions(positions.data(), encodedPositions.data(), vertices.size() * 3, mesh);
+
+		appendMeshletsMeshopt(result, indices, positions, limits);
+	}
+
+	for (uint32_t& v : result.meshletVertices)
+		v = vertices[v];
+}
+
+void buildMeshlets(Mesh& mesh, MeshletBuilder builder, MeshletLimits limits, unsigned int threadCount)
+{
+	assert(limits.maxVertices >= 3 && limits.maxVertices <= MeshletLimits().maxVertices);
+	assert(limits.maxTriangles >= 4 && limits.maxTriangles <= MeshletLimits().maxTriangles);
+
+	// meshlets never straddle partitions; partitions only depend on the mesh, so the result does not depend on the thread count
+	const size_t kPartitionIndices = 32 * 1024 * 3;
+
+	struct Partition {
+		size_t lod;
+		size_t indexOffset, indexCount;
+	};
+
+	std::vector<Partition> partitions;
+
+	for (size_t i = 0; i < mesh.lods.size(); ++i) {
+		const MeshLod& lod = mesh.lods[i];
+
+		for (size_t offset = 0; offset < lod.indexCount; offset += kPartitionIndices)
+			partitions.push_back({ i, lod.indexOffset + offset, std::min(kPartitionIndices, lod.indexCount - offset) });
+	}
+
+	std::vector<Mesh> results(partitions.size());
+
+	parallelFor(partitions.size(), [&](size_t i) {
+		buildMeshletPartition(results[i], mesh, partitions[i].indexOffset, partitions[i].indexCount, builder, limits);
+	}, threadCount);
+
+	// every level gets its own meshlets so that draws can switch levels by meshlet range
+	for (MeshLod& lod : mesh.lods) {
+		lod.meshletOffset = 0;
+		lod.meshletCount = 0;
+	}
+
+	for (size_t i = 0; i < partitions.size(); ++i) {
+		const Mesh& result = results[i];
+		MeshLod& lod = mesh.lods[partitions[i].lod];
+
+		if (lod.meshletCount == 0)
+			lod.meshletOffset = uint32_t(mesh.meshlets.size());
+
+		lod.meshletCount += uint32_t(result.meshlets.size());
+
+		for (Meshlet meshlet : result.meshlets) {
+			meshlet.vertexOffset += uint32_t(mesh.meshletVertices.size());
+			meshlet.triangleOffset += uint32_t(mesh.meshletTriangles.size());
+
+			mesh.meshlets.push_back(meshlet);
+		}
+
+		mesh.meshletVertices.insert(mesh.meshletVertices.end(), result.meshletVertices.begin(), result.meshletVertices.end());
+		mesh.meshletTriangles.insert(mesh.meshletTriangles.end(), result.meshletTriangles.begin(), result.meshletTriangles.end());
+	}
+}
+
+static void buildMeshletBounds(Meshlet& meshlet, const Mesh& mesh)
+{
+	// vx..vz are adjacent in every format, so each meshlet vertex is decoded once in a single batch
+	VertexEncoder::Position encodedPositions[64][3];
+	float positions[64][3];
+
+	for (unsigned int i = 0; i < meshlet.vertexCount; ++i)
+		memcpy(encodedPositions[i], &mesh.vertices[mesh.meshletVertices[meshlet.vertexOffset + i]].vx, sizeof(encodedPositions[i]));
+
+	VertexEncoder::decodePositions(&positions[0][0], &encodedPositions[0][0], meshlet.vertexCount * 3, mesh);
+
+	// triangles index the meshlet's own vertex list, which is the identity on the decoded positions
+	unsigned int vertices[64];
+	for (unsigned int i = 0; i < meshlet.vertexCount; ++i)
+		vertices[i] = i;
+
+	meshopt_Bounds bounds = meshopt_computeMeshletBounds(vertices, &mesh.meshletTriangles[meshlet.triangleOffset], meshlet.triangleCount, &positions[0][0], meshlet.vertexCount, sizeof(positions[0]));
+
+	memcpy(meshlet.center, bounds.center, sizeof(meshlet.center));
+	meshlet.radius = bounds.radius;
+	memcpy(meshlet.coneApex, bounds.cone_apex, sizeof(meshlet.coneApex));
+	memcpy(meshlet.coneAxis, bounds.cone_axis, sizeof(meshlet.coneAxis));
+	meshlet.coneCutoff = bounds.cone_cutoff;
+	memcpy(meshlet.coneAxisS8, bounds.cone_axis_s8, sizeof(meshlet.coneAxisS8));
+	meshlet.coneCutoffS8 = bounds.cone_cutoff_s8;
+}
+
+void buildMeshletBounds(Mesh& mesh, unsigned int threadCount)
+{
+	// meshlets are independent, so the result does not depend on how they are spread over threads; batches keep the scheduling overhead small
+	const size_t kBatchSize = 256;
+
+	parallelFor((mesh.meshlets.size() + kBatchSize - 1) / kBatchSize, [&](size_t batch) {
+		size_t end = std::min(mesh.meshlets.size(), (batch + 1) * kBatchSize);
+
+		for (size_t i = batch * kBatchSize; i < end; ++i)
+			buildMeshletBounds(mesh.meshlets[i], mesh);
+	}, threadCount);
+}
+
+std::shared_ptr<const MeshData> makeMeshData(const std::shared_ptr<const Mesh>& mesh)
+{
+	std::shared_ptr<MeshData> result = std::make_shared<MeshData>();
+
+	result->vertices = mesh->vertices;
+	result->indices = mesh->indices;
+	result->meshlets = mesh->meshlets;
+	result->meshletVertices = mesh->meshletVertices;
+	result->meshletTriangles = mesh->meshletTriangles;
+	result->lods = mesh->lods;
+
+	memcpy(result->positionOffset, mesh->positionOffset, sizeof(result->positionOffset));
+	result->positionScale = mesh->positionScale;
+	memcpy(result->center, mesh->center, sizeof(result->center));
+	result->radius = mesh->radius;
+
+	result->storage = mesh;
+
+	return result;
+}
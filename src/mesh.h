@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "shaders/vertex.h"
+
+// Meshlet header; the vertex and triangle lists live in Mesh::meshletVertices and Mesh::meshletTriangles
+// Mirrors Meshlet in shaders/mesh.h
+struct alignas(16) Meshlet {
+	// bounding sphere and backface cone from meshopt_computeMeshletBounds, in the units positions decode to
+	// the meshlet is backfacing for every camera position p with dot(normalize(coneApex - p), coneAxis) >= coneCutoff
+	float center[3];
+	float radius;
+	float coneApex[3];
+	float coneCutoff;
+	float coneAxis[3];
+	uint32_t vertexOffset; // into meshletVertices
+	uint32_t triangleOffset; // into meshletTriangles, always a multiple of 4
+	uint8_t vertexCount; // up to MeshletLimits::maxVertices
+	uint8_t triangleCount; // up to MeshletLimits::maxTriangles
+
+	// coneAxis and coneCutoff as snorm8 from meshopt_computeMeshletBounds; the cutoff is widened to cover the error of the axis
+	// culling uses these with the bounding sphere instead of the apex, see coneCull in shaders/mesh.h
+	int8_t coneAxisS8[3];
+	int8_t coneCutoffS8;
+};
+
+// One level of detail: a range of Mesh::indices and of Mesh::meshlets
+// error is how far the level may deviate from the full mesh, in the units positions decode to
+struct MeshLod {
+	uint32_t indexOffset;
+	uint32_t indexCount;
+	uint32_t meshletOffset;
+	uint32_t meshletCount;
+	float error;
+};
+
+struct Mesh {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices; // all levels back to back, starting with the full mesh
+	std::vector<Meshlet> meshlets; // all levels back to back
+	std::vector<uint32_t> meshletVertices; // vertex indices of every meshlet, in meshlet order
+	std::vector<uint8_t> meshletTriangles; // 3 meshlet-local vertex indices per triangle, in meshlet order; every meshlet is padded to 4 bytes
+	std::vector<MeshLod> lods; // lods[0] is the full mesh, errors increase from there
+
+	// VERTEX_FORMAT_UNORM16 positions decode as positionOffset + encoded * positionScale; other formats ignore these
+	float positionOffset[3] = {};
+	float positionScale = 1.f;
+
+	// bounding sphere of all vertices, in the units positions decode to
+	float center[3] = {};
+	float radius = 0.f;
+};
+
+// Read-only view of one of the arrays of a mesh
+template <typename T>
+struct MeshSpan {
+	const T* items = 0;
+	size_t count = 0;
+
+	MeshSpan() = default;
+	MeshSpan(const T* items, size_t count): items(items), count(count) {}
+	MeshSpan(const std::vector<T>& data): items(data.data()), count(data.size()) {}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	const T* data() const { return items; }
+	const T* begin() const { return items; }
+	const T* end() const { return items + count; }
+
+	const T& operator[](size_t index) const { return items[index]; }
+};
+
+// The arrays of a mesh as the scene consumes them; they point into a Mesh, or into an uncompressed mesh cache that stays mapped
+// so that cached meshes go from the page cache to the scene without a copy on the heap, and storage keeps either of them alive
+struct MeshData {
+	MeshSpan<Vertex> vertices;
+	MeshSpan<uint32_t> indices;
+	MeshSpan<Meshlet> meshlets;
+	MeshSpan<uint32_t> meshletVertices;
+	MeshSpan<uint8_t> meshletTriangles;
+	MeshSpan<MeshLod> lods;
+
+	float positionOffset[3] = {};
+	float positionScale = 1.f;
+
+	float center[3] = {};
+	float radius = 0.f;
+
+	std::shared_ptr<const void> storage;
+};
+
+enum MeshletBuilder {
+	MeshletBuilder_Greedy, // index order, cut when a meshlet is full
+	MeshletBuilder_Meshopt, // meshopt_buildMeshlets, spatially compact and weighted towards narrow cones
+};
+
+// Largest meshlets buildMeshlets builds; the mesh shader outputs a whole meshlet, so these follow the variant of it the device can run
+// 64 and 126 are the most meshlets can hold
+struct MeshletLimits {
+	uint32_t maxVertices = 64;
+	uint32_t maxTriangles = 126;
+};
+
+bool loadMesh(Mesh& result, const char* path, bool lowMemory = false);
+bool loadMeshGltf(Mesh& result, const char* path);
+void buildMeshLods(Mesh& mesh);
+// Both run on up to threadCount threads (0 = all cores) and produce the same result for any thread count
+void buildMeshlets(Mesh& mesh, MeshletBuilder builder = MeshletBuilder_Meshopt, MeshletLimits limits = MeshletLimits(), unsigned int threadCount = 0);
+void buildMeshletBounds(Mesh& mesh, unsigned int threadCount = 0);
+
+// Views of the arrays of mesh that keep it alive
+std::shared_ptr<const MeshData> makeMeshData(const std::shared_ptr<const Mesh>& mesh);
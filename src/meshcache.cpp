@@ -0,0 +1,296 @@
+#include "common.h"
+#include "meshcache.h"
+#include "mesh.h"
+#include "fileio.h"
+#include "meshcodec.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Bump whenever the layout of Vertex/Meshlet/MeshLod or the processing in loadMesh/buildMeshLods/buildMeshlets changes; VERTEX_FORMAT is checked separately
+const uint32_t kMeshCacheMagic = 0x4843534d; // 'MSCH'
+const uint32_t kMeshCacheVersion = 12;
+
+enum MeshCacheStreamType {
+	MeshCacheStream_Vertices,
+	MeshCacheStream_Indices,
+	MeshCacheStream_Meshlets,
+	MeshCacheStream_MeshletVertices,
+	MeshCacheStream_MeshletTriangles,
+	MeshCacheStream_Encoded, // meshcodec container with all of the above; the raw streams are empty when it is used
+	MeshCacheStream_Lods, // always raw, it is tiny
+
+	MeshCacheStream_Count
+};
+
+struct MeshCacheStream {
+	uint64_t offset;
+	uint64_t count;
+	uint32_t stride;
+	uint32_t reserved;
+};
+
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t options;
+	uint32_t streamCount;
+
+	// the source is only hashed when its size and write time no longer match, see loadMeshCache
+	uint64_t sourceHash;
+	uint64_t sourceSize;
+	uint64_t sourceTime;
+
+	uint32_t vertexFormat;
+	float positionOffset[3];
+	float positionScale;
+	float center[3];
+	float radius;
+
+	// meshlets depend on the limits of the device they were built for, see MeshletLimits
+	uint16_t meshletMaxVertices;
+	uint16_t meshletMaxTriangles;
+
+	MeshCacheStream streams[MeshCacheStream_Count];
+};
+
+static uint64_t rotl64(uint64_t v, int r)
+{
+	return (v << r) | (v >> (64 - r));
+}
+
+// 4-lane multiply-rotate hash modelled after xxHash64; runs close to memory bandwidth on large files
+static uint64_t hashData(const void* data, size_t size)
+{
+	const uint64_t prime1 = 0x9e3779b185ebca87ull;
+	const uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
+	const uint64_t prime3 = 0x165667b19e3779f9ull;
+
+	const unsigned char* ptr = static_cast<const unsigned char*>(data);
+	const unsigned char* end = ptr + size;
+
+	uint64_t acc[4] = { prime1 + prime2, prime2, 0, 0 - prime1 };
+
+	for (; ptr + 32 <= end; ptr += 32) {
+		for (int i = 0; i < 4; ++i) {
+			uint64_t lane;
+			memcpy(&lane, ptr + i * 8, 8);
+			acc[i] = rotl64(acc[i] + lane * prime2, 31) * prime1;
+		}
+	}
+
+	uint64_t h = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18) + uint64_t(size);
+
+	for (; ptr < end; ++ptr)
+		h = rotl64(h ^ (*ptr * prime3), 11) * prime1;
+
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static bool hashSource(uint64_t& hash, const char* path)
+{
+	MappedFile source;
+	if (!mapFile(source, path))
+		return false;
+
+	hash = hashData(source.data, source.size);
+
+	unmapFile(source);
+	return true;
+}
+
+static void getCachePath(char* result, size_t size, const char* path)
+{
+	snprintf(result, size, "%s.meshcache", path);
+}
+
+// Streams are read in place; the mapping is page aligned and streams are 16-byte aligned, see writeStream
+template <typename T>
+static bool readStream(MeshSpan<T>& result, const MappedFile& file, const MeshCacheStream& stream)
+{
+	if (stream.stride != sizeof(T) || stream.offset % alignof(T) != 0)
+		return false;
+
+	if (stream.offset > file.size || stream.count > (file.size - stream.offset) / sizeof(T))
+		return false;
+
+	result = MeshSpan<T>(reinterpret_cast<const T*>(static_cast<const char*>(file.data) + stream.offset), size_t(stream.count));
+
+	return true;
+}
+
+template <typename T>
+static void writeStream(FILE* file, uint64_t& offset, MeshCacheStream& stream, const std::vector<T>& data)
+{
+	static const char padding[16] = {};
+
+	size_t paddingSize = size_t((16 - offset % 16) % 16);
+	fwrite(padding, 1, paddingSize, file);
+	offset += paddingSize;
+
+	stream.offset = offset;
+	stream.count = data.size();
+	stream.stride = sizeof(T);
+
+	fwrite(data.data(), sizeof(T), data.size(), file);
+	offset += data.size() * sizeof(T);
+}
+
+static bool readEncodedStream(Mesh& result, const MappedFile& file, const MeshCacheStream& stream)
+{
+	if (stream.stride != 1 || stream.offset > file.size || stream.count > file.size - stream.offset)
+		return false;
+
+	return decodeMeshGeometry(result, static_cast<const char*>(file.data) + stream.offset, size_t(stream.count));
+}
+
+bool loadMeshCache(std::shared_ptr<const MeshData>& result, const char* path, uint32_t options, const MeshletLimits& limits)
+{
+	char cachePath[1024];
+	getCachePath(cachePath, sizeof(cachePath), path);
+
+	MappedFile file;
+	if (!mapFile(file, cachePath))
+		return false;
+
+	MeshCacheHeader header;
+	if (file.size < sizeof(header)) {
+		unmapFile(file);
+		return false;
+	}
+
+	memcpy(&header, file.data, sizeof(header));
+
+	const uint32_t kLoadOnlyOptions = MeshCache_Compressed | MeshCache_ValidateSource;
+
+	uint64_t sourceSize = 0, sourceTime = 0;
+
+	bool valid =
+		header.magic == kMeshCacheMagic &&
+		header.version == kMeshCacheVersion &&
+		(header.options & ~kLoadOnlyOptions) == (options & ~kLoadOnlyOptions) &&
+		header.streamCount == MeshCacheStream_Count &&
+		header.vertexFormat == VERTEX_FORMAT &&
+		header.meshletMaxVertices == limits.maxVertices &&
+		header.meshletMaxTriangles == limits.maxTriangles &&
+		getFileInfo(path, sourceSize, sourceTime) &&
+		header.sourceSize == sourceSize;
+
+	// hashing multi-GB sources takes seconds, so an unchanged size and write time is trusted; a touched source only costs the hash
+	if (valid && (header.sourceTime != sourceTime || (options & MeshCache_ValidateSource))) {
+		uint64_t sourceHash = 0;
+		valid = hashSource(sourceHash, path) && header.sourceHash == sourceHash;
+	}
+
+	std::shared_ptr<MeshData> data = std::make_shared<MeshData>();
+
+	if (valid && (header.options & MeshCache_Compressed)) {
+		// decoding needs somewhere to write, so compressed caches end up on the heap like freshly built meshes
+		std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+		MeshSpan<MeshLod> lods;
+
+		valid =
+			readEncodedStream(*mesh, file, header.streams[MeshCacheStream_Encoded]) &&
+			readStream(lods, file, header.streams[MeshCacheStream_Lods]);
+
+		if (valid) {
+			mesh->lods.assign(lods.begin(), lods.end());
+			*data = *makeMeshData(mesh);
+		}
+
+		unmapFile(file);
+	}
+	else {
+		valid = valid &&
+			readStream(data->vertices, file, header.streams[MeshCacheStream_Vertices]) &&
+			readStream(data->indices, file, header.streams[MeshCacheStream_Indices]) &&
+			readStream(data->meshlets, file, header.streams[MeshCacheStream_Meshlets]) &&
+			readStream(data->meshletVertices, file, header.streams[MeshCacheStream_MeshletVertices]) &&
+			readStream(data->meshletTriangles, file, header.streams[MeshCacheStream_MeshletTriangles]) &&
+			readStream(data->lods, file, header.streams[MeshCacheStream_Lods]);
+
+		// the mapping lives as long as the chunks that point into it; its pages are backed by the file, so the system can drop them under pressure
+		if (valid)
+			data->storage = std::shared_ptr<MappedFile>(new MappedFile(file), [](MappedFile* mapping) { unmapFile(*mapping); delete mapping; });
+		else
+			unmapFile(file);
+	}
+
+	if (!valid)
+		return false;
+
+	memcpy(data->positionOffset, header.positionOffset, sizeof(data->positionOffset));
+	data->positionScale = header.positionScale;
+	memcpy(data->center, header.center, sizeof(data->center));
+	data->radius = header.radius;
+
+	result = data;
+	return true;
+}
+
+bool saveMeshCache(const Mesh& mesh, const char* path, uint32_t options, const MeshletLimits& limits)
+{
+	MeshCacheHeader header = {};
+	header.magic = kMeshCacheMagic;
+	header.version = kMeshCacheVersion;
+	header.options = options & ~MeshCache_ValidateSource;
+	header.streamCount = MeshCacheStream_Count;
+	header.vertexFormat = VERTEX_FORMAT;
+	header.meshletMaxVertices = uint16_t(limits.maxVertices);
+	header.meshletMaxTriangles = uint16_t(limits.maxTriangles);
+	memcpy(header.positionOffset, mesh.positionOffset, sizeof(header.positionOffset));
+	header.positionScale = mesh.positionScale;
+	memcpy(header.center, mesh.center, sizeof(header.center));
+	header.radius = mesh.radius;
+
+	if (!getFileInfo(path, header.sourceSize, header.sourceTime) || !hashSource(header.sourceHash, path))
+		return false;
+
+	char cachePath[1024];
+	getCachePath(cachePath, sizeof(cachePath), path);
+
+	FILE* file = fopen(cachePath, "wb");
+	if (!file)
+		return false;
+
+	// header is written last so that a partially written cache never validates
+	MeshCacheHeader placeholder = {};
+	fwrite(&placeholder, sizeof(placeholder), 1, file);
+
+	uint64_t offset = sizeof(placeholder);
+
+	if (options & MeshCache_Compressed) {
+		std::vector<unsigned char> encoded;
+		encodeMeshGeometry(encoded, mesh);
+
+		writeStream(file, offset, header.streams[MeshCacheStream_Encoded], encoded);
+	}
+	else {
+		writeStream(file, offset, header.streams[MeshCacheStream_Vertices], mesh.vertices);
+		writeStream(file, offset, header.streams[MeshCacheStream_Indices], mesh.indices);
+		writeStream(file, offset, header.streams[MeshCacheStream_Meshlets], mesh.meshlets);
+		writeStream(file, offset, header.streams[MeshCacheStream_MeshletVertices], mesh.meshletVertices);
+		writeStream(file, offset, header.streams[MeshCacheStream_MeshletTriangles], mesh.meshletTriangles);
+	}
+
+	writeStream(file, offset, header.streams[MeshCacheStream_Lods], mesh.lods);
+
+	fseek(file, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, file);
+
+	bool ok = !ferror(file);
+	ok &= fclose(file) == 0;
+
+	if (!ok) {
+		remove(cachePath);
+		printf("Warning: failed to write mesh cache %s\n", cachePath);
+	}
+
+	return ok;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+
+struct Mesh;
+struct MeshData;
+struct MeshletLimits;
+
+enum MeshCacheOptions {
+	MeshCache_Meshlets = 1 << 0,
+	MeshCache_Compressed = 1 << 1, // only affects how the cache is written; either kind of cache is accepted on load
+	MeshCache_GreedyMeshlets = 1 << 2, // meshlets come from MeshletBuilder_Greedy instead of MeshletBuilder_Meshopt
+	MeshCache_ValidateSource = 1 << 3, // only affects loading: the source is hashed even when its size and write time match the cache
+};
+
+// Uncompressed caches stay mapped and result points into the mapping; compressed caches are decoded into a Mesh
+// Caches only load with the meshlet limits they were saved with
+bool loadMeshCache(std::shared_ptr<const MeshData>& result, const char* path, uint32_t options, const MeshletLimits& limits);
+bool saveMeshCache(const Mesh& mesh, const char* path, uint32_t options, const MeshletLimits& limits);
@@ -0,0 +1,268 @@
+#include "common.h"
+#include "meshcodec.h"
+#include "mesh.h"
+#include "parallel.h"
+
+#include <string.h>
+
+#include <atomic>
+
+#include <meshoptimizer.h>
+
+const uint32_t kMeshCodecMagic = 0x5a48534d; // 'MSHZ'
+
+// Uncompressed bytes per block: enough blocks to keep every core busy on a mid-sized mesh, few enough that the block table stays negligible
+const size_t kBlockSize = 256 * 1024;
+
+// Triangle lists are bytes, which the vertex codec cannot take as elements; every meshlet pads its list to 4 bytes so the stream splits into words
+const size_t kTriangleElementSize = 4;
+
+enum MeshCodecStream {
+	MeshCodecStream_Vertices,
+	MeshCodecStream_Indices,
+	MeshCodecStream_Meshlets,
+	MeshCodecStream_MeshletVertices,
+	MeshCodecStream_MeshletTriangles,
+
+	MeshCodecStream_Count
+};
+
+struct MeshCodecHeader {
+	uint32_t magic;
+	uint32_t blockCount;
+	uint32_t strides[MeshCodecStream_Count];
+	uint32_t reserved;
+	uint64_t counts[MeshCodecStream_Count];
+};
+
+// Blocks of a stream are stored in order; first and count are in codec elements (see getElementSize)
+struct MeshCodecBlock {
+	uint64_t offset; // relative to the end of the block table
+	uint64_t first;
+	uint32_t count;
+	uint32_t size;
+	uint32_t stream;
+	uint32_t reserved;
+};
+
+static size_t getElementSize(uint32_t stream, size_t stride)
+{
+	return stream == MeshCodecStream_MeshletTriangles ? kTriangleElementSize : stride;
+}
+
+static size_t getBlockElements(uint32_t stream, size_t elementSize)
+{
+	size_t count = kBlockSize / elementSize;
+
+	// the index codec works on whole triangles
+	return stream == MeshCodecStream_Indices ? count - count % 3 : count;
+}
+
+// Copies the header and block table out of the container and checks that the blocks tile every stream exactly
+static bool readContainer(MeshCodecHeader& header, std::vector<MeshCodecBlock>& blocks, const void* data, size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+	if (size < sizeof(header))
+		return false;
+
+	memcpy(&header, bytes, sizeof(header));
+
+	if (header.magic != kMeshCodecMagic)
+		return false;
+
+	if (header.strides[MeshCodecStream_Vertices] != sizeof(Vertex) || header.strides[MeshCodecStream_Indices] != sizeof(uint32_t) || header.strides[MeshCodecStream_Meshlets] != sizeof(Meshlet) ||
+		header.strides[MeshCodecStream_MeshletVertices] != sizeof(uint32_t) || header.strides[MeshCodecStream_MeshletTriangles] != sizeof(uint8_t))
+		return false;
+
+	if (header.counts[MeshCodecStream_MeshletTriangles] % kTriangleElementSize != 0)
+		return false;
+
+	if (header.blockCount > (size - sizeof(header)) / sizeof(MeshCodecBlock))
+		return false;
+
+	blocks.resize(header.blockCount);
+	memcpy(blocks.data(), bytes + sizeof(header), blocks.size() * sizeof(MeshCodecBlock));
+
+	size_t payloadSize = size - sizeof(header) - blocks.size() * sizeof(MeshCodecBlock);
+
+	uint64_t next[MeshCodecStream_Count] = {};
+
+	for (const MeshCodecBlock& block : blocks) {
+		if (block.stream >= MeshCodecStream_Count || block.first != next[block.stream])
+			return false;
+
+		if (block.offset > payloadSize || block.size > payloadSize - block.offset)
+			return false;
+
+		if (block.stream == MeshCodecStream_Indices && block.count % 3 != 0)
+			return false;
+
+		next[block.stream] += block.count;
+	}
+
+	for (uint32_t stream = 0; stream < MeshCodecStream_Count; ++stream)
+		if (header.counts[stream] > SIZE_MAX / header.strides[stream] || next[stream] != header.counts[stream] * header.strides[stream] / getElementSize(stream, header.strides[stream]))
+			return false;
+
+	return true;
+}
+
+void encodeMeshGeometry(std::vector<unsigned char>& result, const Mesh& mesh, unsigned int threadCount)
+{
+	static_assert(sizeof(Vertex) % 4 == 0 && sizeof(Vertex) <= 256, "vertex codec needs elements that are a multiple of 4 bytes and at most 256 bytes");
+	static_assert(sizeof(Meshlet) % 4 == 0 && sizeof(Meshlet) <= 256, "vertex codec needs elements that are a multiple of 4 bytes and at most 256 bytes");
+
+	assert(mesh.indices.size() % 3 == 0);
+	assert(mesh.meshletTriangles.size() % kTriangleElementSize == 0);
+
+	MeshCodecHeader header = {};
+	header.magic = kMeshCodecMagic;
+	header.strides[MeshCodecStream_Vertices] = sizeof(Vertex);
+	header.strides[MeshCodecStream_Indices] = sizeof(uint32_t);
+	header.strides[MeshCodecStream_Meshlets] = sizeof(Meshlet);
+	header.strides[MeshCodecStream_MeshletVertices] = sizeof(uint32_t);
+	header.strides[MeshCodecStream_MeshletTriangles] = sizeof(uint8_t);
+	header.counts[MeshCodecStream_Vertices] = mesh.vertices.size();
+	header.counts[MeshCodecStream_Indices] = mesh.indices.size();
+	header.counts[MeshCodecStream_Meshlets] = mesh.meshlets.size();
+	header.counts[MeshCodecStream_MeshletVertices] = mesh.meshletVertices.size();
+	header.counts[MeshCodecStream_MeshletTriangles] = mesh.meshletTriangles.size();
+
+	const unsigned char* sources[MeshCodecStream_Count] = {
+		reinterpret_cast<const unsigned char*>(mesh.vertices.data()),
+		reinterpret_cast<const unsigned char*>(mesh.indices.data()),
+		reinterpret_cast<const unsigned char*>(mesh.meshlets.data()),
+		reinterpret_cast<const unsigned char*>(mesh.meshletVertices.data()),
+		mesh.meshletTriangles.data(),
+	};
+
+	std::vector<MeshCodecBlock> blocks;
+
+	for (uint32_t stream = 0; stream < MeshCodecStream_Count; ++stream) {
+		size_t elementSize = getElementSize(stream, header.strides[stream]);
+		size_t elementCount = header.counts[stream] * header.strides[stream] / elementSize;
+		size_t blockElements = getBlockElements(stream, elementSize);
+
+		for (size_t first = 0; first < elementCount; first += blockElements) {
+			MeshCodecBlock block = {};
+			block.first = first;
+			block.count = uint32_t(std::min(blockElements, elementCount - first));
+			block.stream = stream;
+
+			blocks.push_back(block);
+		}
+	}
+
+	std::vector<std::vector<unsigned char>> payloads(blocks.size());
+
+	parallelFor(blocks.size(), [&](size_t i) {
+		MeshCodecBlock& block = blocks[i];
+		std::vector<unsigned char>& payload = payloads[i];
+
+		size_t elementSize = getElementSize(block.stream, header.strides[block.stream]);
+		const unsigned char* source = sources[block.stream] + block.first * elementSize;
+
+		if (block.stream == MeshCodecStream_Indices) {
+			payload.resize(meshopt_encodeIndexBufferBound(block.count, mesh.vertices.size()));
+			payload.resize(meshopt_encodeIndexBuffer(payload.data(), payload.size(), reinterpret_cast<const unsigned int*>(source), block.count));
+		}
+		else {
+			payload.resize(meshopt_encodeVertexBufferBound(block.count, elementSize));
+			payload.resize(meshopt_encodeVertexBuffer(payload.data(), payload.size(), source, block.count, elementSize));
+		}
+
+		assert(!payload.empty());
+		block.size = uint32_t(payload.size());
+	}, threadCount);
+
+	uint64_t offset = 0;
+
+	for (MeshCodecBlock& block : blocks) {
+		block.offset = offset;
+		offset += block.size;
+	}
+
+	header.blockCount = uint32_t(blocks.size());
+
+	result.resize(sizeof(header) + blocks.size() * sizeof(MeshCodecBlock) + offset);
+
+	unsigned char* data = result.data();
+
+	memcpy(data, &header, sizeof(header));
+	data += sizeof(header);
+
+	memcpy(data, blocks.data(), blocks.size() * sizeof(MeshCodecBlock));
+	data += blocks.size() * sizeof(MeshCodecBlock);
+
+	for (size_t i = 0; i < blocks.size(); ++i)
+		memcpy(data + blocks[i].offset, payloads[i].data(), payloads[i].size());
+}
+
+bool decodeMeshGeometry(Mesh& result, const void* data, size_t size, unsigned int threadCount)
+{
+	MeshCodecHeader header;
+	std::vector<MeshCodecBlock> blocks;
+
+	if (!readContainer(header, blocks, data, size))
+		return false;
+
+	const unsigned char* payload = static_cast<const unsigned char*>(data) + sizeof(header) + blocks.size() * sizeof(MeshCodecBlock);
+
+	std::vector<Vertex> vertices(header.counts[MeshCodecStream_Vertices]);
+	std::vector<uint32_t> indices(header.counts[MeshCodecStream_Indices]);
+	std::vector<Meshlet> meshlets(header.counts[MeshCodecStream_Meshlets]);
+	std::vector<uint32_t> meshletVertices(header.counts[MeshCodecStream_MeshletVertices]);
+	std::vector<uint8_t> meshletTriangles(header.counts[MeshCodecStream_MeshletTriangles]);
+
+	unsigned char* destinations[MeshCodecStream_Count] = {
+		reinterpret_cast<unsigned char*>(vertices.data()),
+		reinterpret_cast<unsigned char*>(indices.data()),
+		reinterpret_cast<unsigned char*>(meshlets.data()),
+		reinterpret_cast<unsigned char*>(meshletVertices.data()),
+		meshletTriangles.data(),
+	};
+
+	std::atomic<bool> failed(false);
+
+	parallelFor(blocks.size(), [&](size_t i) {
+		const MeshCodecBlock& block = blocks[i];
+
+		size_t elementSize = getElementSize(block.stream, header.strides[block.stream]);
+		unsigned char* destination = destinations[block.stream] + block.first * elementSize;
+
+		int rc = block.stream == MeshCodecStream_Indices
+			? meshopt_decodeIndexBuffer(destination, block.count, sizeof(uint32_t), payload + block.offset, block.size)
+			: meshopt_decodeVertexBuffer(destination, block.count, elementSize, payload + block.offset, block.size);
+
+		if (rc != 0)
+			failed = true;
+	}, threadCount);
+
+	if (failed)
+		return false;
+
+	result.vertices = std::move(vertices);
+	result.indices = std::move(indices);
+	result.meshlets = std::move(meshlets);
+	result.meshletVertices = std::move(meshletVertices);
+	result.meshletTriangles = std::move(meshletTriangles);
+
+	return true;
+}
+
+size_t getMeshGeometrySize(const void* data, size_t size)
+{
+	MeshCodecHeader header;
+	std::vector<MeshCodecBlock> blocks;
+
+	if (!readContainer(header, blocks, data, size))
+		return 0;
+
+	size_t result = 0;
+
+	for (uint32_t stream = 0; stream < MeshCodecStream_Count; ++stream)
+		result += header.counts[stream] * header.strides[stream];
+
+	return result;
+}
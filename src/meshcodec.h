@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+struct Mesh;
+
+// Compressed container for the vertices, indices and meshlets (with their vertex and triangle lists) of a Mesh
+// Every stream is cut into blocks that are encoded independently with the meshopt vertex/index codecs, so decoding runs in parallel across blocks
+// Decoding is lossless except that the index codec may rotate the corners of a triangle; winding and triangle order are preserved
+// Position bounds are not part of the container; they are stored by whoever stores the container (see meshcache.cpp)
+void encodeMeshGeometry(std::vector<unsigned char>& result, const Mesh& mesh, unsigned int threadCount = 0);
+bool decodeMeshGeometry(Mesh& result, const void* data, size_t size, unsigned int threadCount = 0);
+
+// Uncompressed size of the geometry described by a container, or 0 if the container is malformed
+size_t getMeshGeometrySize(const void* data, size_t size);
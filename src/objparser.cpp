@@ -0,0 +1,382 @@
+#include "common.h"
+#include "objparser.h"
+#include "fileio.h"
+#include "parallel.h"
+
+#include <string.h>
+
+#include <string>
+
+// The tokenizer below follows fast_obj exactly (including its float parser) so that both produce bit-identical meshes
+
+struct ObjCounts {
+	size_t positions;
+	size_t texcoords;
+	size_t normals;
+	size_t faces;
+	size_t indices;
+};
+
+struct ObjChunk {
+	const char* begin;
+	const char* end;
+
+	ObjCounts counts;
+	ObjCounts offsets;
+};
+
+const int kMaxPower = 20;
+
+static const double kPowers10Pos[kMaxPower] =
+{
+	1.0e0,  1.0e1,  1.0e2,  1.0e3,  1.0e4,  1.0e5,  1.0e6,  1.0e7,  1.0e8,  1.0e9,
+	1.0e10, 1.0e11, 1.0e12, 1.0e13, 1.0e14, 1.0e15, 1.0e16, 1.0e17, 1.0e18, 1.0e19,
+};
+
+static const double kPowers10Neg[kMaxPower] =
+{
+	1.0e0,   1.0e-1,  1.0e-2,  1.0e-3,  1.0e-4,  1.0e-5,  1.0e-6,  1.0e-7,  1.0e-8,  1.0e-9,
+	1.0e-10, 1.0e-11, 1.0e-12, 1.0e-13, 1.0e-14, 1.0e-15, 1.0e-16, 1.0e-17, 1.0e-18, 1.0e-19,
+};
+
+static bool isWhitespace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool isNewline(char c)
+{
+	return c == '\n';
+}
+
+static bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static const char* skipWhitespace(const char* ptr)
+{
+	while (isWhitespace(*ptr))
+		ptr++;
+
+	return ptr;
+}
+
+static const char* skipLine(const char* ptr)
+{
+	while (!isNewline(*ptr++))
+		;
+
+	return ptr;
+}
+
+static const char* parseInt(const char* ptr, int* val)
+{
+	int sign = 1;
+
+	if (*ptr == '-') {
+		sign = -1;
+		ptr++;
+	}
+
+	int num = 0;
+	while (isDigit(*ptr))
+		num = 10 * num + (*ptr++ - '0');
+
+	*val = sign * num;
+
+	return ptr;
+}
+
+static const char* parseFloat(const char* ptr, float* val)
+{
+	ptr = skipWhitespace(ptr);
+
+	double sign = 1.0;
+
+	if (*ptr == '+') {
+		ptr++;
+	}
+	else if (*ptr == '-') {
+		sign = -1.0;
+		ptr++;
+	}
+
+	double num = 0.0;
+	while (isDigit(*ptr))
+		num = 10.0 * num + double(*ptr++ - '0');
+
+	if (*ptr == '.')
+		ptr++;
+
+	double fra = 0.0;
+	double div = 1.0;
+
+	while (isDigit(*ptr)) {
+		fra = 10.0 * fra + double(*ptr++ - '0');
+		div *= 10.0;
+	}
+
+	num += fra / div;
+
+	if (*ptr == 'e' || *ptr == 'E') {
+		ptr++;
+
+		const double* powers = kPowers10Pos;
+
+		if (*ptr == '+') {
+			ptr++;
+		}
+		else if (*ptr == '-') {
+			powers = kPowers10Neg;
+			ptr++;
+		}
+
+		unsigned int eval = 0;
+		while (isDigit(*ptr))
+			eval = 10 * eval + (*ptr++ - '0');
+
+		num *= (eval >= kMaxPower) ? 0.0 : powers[eval];
+	}
+
+	*val = float(sign * num);
+
+	return ptr;
+}
+
+static const char* parseFloats(const char* ptr, float* result, int count)
+{
+	for (int i = 0; i < count; ++i)
+		ptr = parseFloat(ptr, &result[i]);
+
+	return ptr;
+}
+
+static uint32_t resolveIndex(int index, size_t count)
+{
+	// negative indices are relative to the attribute count so far; count includes the dummy element
+	return index < 0 ? uint32_t(count) - uint32_t(-index) : uint32_t(index);
+}
+
+// Tokenizes a face; indices are only written when there is room, which lets the counting pass share this code
+// Faces that reference an invalid vertex are dropped and report a vertex count of 0
+static const char* parseFace(const char* ptr, uint32_t& count, ObjIndex* indices, size_t capacity, const ObjCounts& current)
+{
+	ptr = skipWhitespace(ptr);
+
+	count = 0;
+
+	while (!isNewline(*ptr)) {
+		int v = 0, t = 0, n = 0;
+
+		ptr = parseInt(ptr, &v);
+		if (*ptr == '/') {
+			ptr++;
+			if (*ptr != '/')
+				ptr = parseInt(ptr, &t);
+
+			if (*ptr == '/') {
+				ptr++;
+				ptr = parseInt(ptr, &n);
+			}
+		}
+
+		if (v == 0) {
+			count = 0;
+			return ptr;
+		}
+
+		if (count < capacity) {
+			ObjIndex& index = indices[count];
+			index.p = resolveIndex(v, current.positions);
+			index.t = resolveIndex(t, current.texcoords);
+			index.n = resolveIndex(n, current.normals);
+		}
+
+		count++;
+
+		ptr = skipWhitespace(ptr);
+	}
+
+	return ptr;
+}
+
+// When result is null this only counts attributes and faces; otherwise it writes them at chunk.offsets
+static void parseChunk(ObjChunk& chunk, ObjFile* result)
+{
+	ObjCounts current = {};
+
+	if (result) {
+		// +1 accounts for the dummy element at the start of every attribute array
+		current = chunk.offsets;
+		current.positions++;
+		current.texcoords++;
+		current.normals++;
+	}
+
+	size_t indicesEnd = chunk.offsets.indices + chunk.counts.indices;
+
+	const char* p = chunk.begin;
+
+	while (p != chunk.end) {
+		p = skipWhitespace(p);
+
+		switch (*p) {
+		case 'v':
+			p++;
+
+			switch (*p++) {
+			case ' ':
+			case '\t':
+				if (result)
+					p = parseFloats(p, &result->positions[current.positions * 3], 3);
+				current.positions++;
+				break;
+
+			case 't':
+				if (result)
+					p = parseFloats(p, &result->texcoords[current.texcoords * 2], 2);
+				current.texcoords++;
+				break;
+
+			case 'n':
+				if (result)
+					p = parseFloats(p, &result->normals[current.normals * 3], 3);
+				current.normals++;
+				break;
+
+			default:
+				p--; // roll p++ back in case *p was a newline
+			}
+			break;
+
+		case 'f':
+			p++;
+
+			switch (*p++) {
+			case ' ':
+			case '\t':
+			{
+				ObjIndex* indices = result ? result->indices.data() + current.indices : 0;
+				size_t capacity = result ? indicesEnd - current.indices : 0;
+
+				uint32_t count = 0;
+				p = parseFace(p, count, indices, capacity, current);
+
+				if (count) {
+					if (result)
+						result->faceVertices[current.faces] = count;
+
+					current.faces++;
+					current.indices += count;
+				}
+			}
+			break;
+
+			default:
+				p--; // roll p++ back in case *p was a newline
+			}
+			break;
+		}
+
+		p = skipLine(p);
+	}
+
+	if (!result)
+		chunk.counts = current;
+}
+
+bool parseObj(ObjFile& result, const char* path, unsigned int threadCount, bool lowMemory)
+{
+	MappedFile file;
+	if (!mapFile(file, path))
+		return false;
+
+	const char* data = static_cast<const char*>(file.data);
+	size_t size = file.size;
+
+	// the tokenizer relies on every line being terminated, so an unterminated last line is parsed from a copy
+	const char* lastNewline = data + size;
+	while (lastNewline > data && !isNewline(lastNewline[-1]))
+		lastNewline--;
+
+	std::string tail(lastNewline, data + size);
+	tail += '\n';
+
+	size_t bodySize = lastNewline - data;
+
+	if (threadCount == 0)
+		threadCount = getThreadCount();
+
+	// several chunks per thread keep the workers balanced when line mix varies across the file
+	const size_t kMinChunkSize = 1 << 20;
+	size_t chunkCount = std::max(size_t(1), std::min(bodySize / kMinChunkSize, size_t(threadCount) * 8));
+
+	std::vector<ObjChunk> chunks;
+	chunks.reserve(chunkCount + 1);
+
+	const char* begin = data;
+
+	for (size_t i = 1; i <= chunkCount && begin < lastNewline; ++i) {
+		const char* end = lastNewline;
+
+		if (i < chunkCount) {
+			end = data + bodySize / chunkCount * i;
+			end = end < begin ? begin : end;
+
+			const char* newline = static_cast<const char*>(memchr(end, '\n', lastNewline - end));
+			end = newline ? newline + 1 : lastNewline;
+		}
+
+		if (end > begin) {
+			ObjChunk chunk = {};
+			chunk.begin = begin;
+			chunk.end = end;
+			chunks.push_back(chunk);
+		}
+
+		begin = end;
+	}
+
+	if (tail.size() > 1) {
+		ObjChunk chunk = {};
+		chunk.begin = tail.data();
+		chunk.end = tail.data() + tail.size();
+		chunks.push_back(chunk);
+	}
+
+	auto releaseChunk = [&](const ObjChunk& chunk) {
+		if (lowMemory && chunk.begin >= data && chunk.end <= data + size)
+			releaseFileRange(file, chunk.begin - data, chunk.end - chunk.begin);
+	};
+
+	parallelFor(chunks.size(), [&](size_t i) { parseChunk(chunks[i], 0); releaseChunk(chunks[i]); }, threadCount);
+
+	ObjCounts total = {};
+
+	for (ObjChunk& chunk : chunks) {
+		chunk.offsets = total;
+
+		total.positions += chunk.counts.positions;
+		total.texcoords += chunk.counts.texcoords;
+		total.normals += chunk.counts.normals;
+		total.faces += chunk.counts.faces;
+		total.indices += chunk.counts.indices;
+	}
+
+	result.positions.resize((total.positions + 1) * 3);
+	result.texcoords.resize((total.texcoords + 1) * 2);
+	result.normals.resize((total.normals + 1) * 3);
+	result.faceVertices.resize(total.faces);
+	result.indices.resize(total.indices);
+	result.fileSize = size;
+
+	// same dummy attributes as fast_obj, notably the +Z default normal
+	result.normals[2] = 1.f;
+
+	parallelFor(chunks.size(), [&](size_t i) { parseChunk(chunks[i], &result); releaseChunk(chunks[i]); }, threadCount);
+
+	unmapFile(file);
+
+	return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+struct ObjIndex {
+	uint32_t p, t, n;
+};
+
+// Mirrors the fast_obj layout: attribute arrays start with a dummy element so that index 0 means "not present"
+struct ObjFile {
+	std::vector<float> positions;
+	std::vector<float> texcoords;
+	std::vector<float> normals;
+
+	std::vector<uint32_t> faceVertices;
+	std::vector<ObjIndex> indices;
+
+	size_t fileSize;
+};
+
+// lowMemory releases file pages as chunks are consumed, trading page faults for a smaller working set
+bool parseObj(ObjFile& result, const char* path, unsigned int threadCount = 0, bool lowMemory = false);
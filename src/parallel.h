@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+inline unsigned int getThreadCount()
+{
+	unsigned int count = std::thread::hardware_concurrency();
+	return count ? count : 1;
+}
+
+// Runs body(i) for every i in [0, count) on up to threadCount threads (0 = all cores); items are handed out dynamically
+template <typename Body>
+void parallelFor(size_t count, const Body& body, unsigned int threadCount = 0)
+{
+	if (threadCount == 0)
+		threadCount = getThreadCount();
+
+	threadCount = unsigned(std::min(size_t(threadCount), count));
+
+	if (threadCount <= 1) {
+		for (size_t i = 0; i < count; ++i)
+			body(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++)
+			body(i);
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount - 1);
+
+	for (unsigned int i = 1; i < threadCount; ++i)
+		threads.emplace_back(worker);
+
+	worker();
+
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+// Fixed-capacity queue for exactly one producer thread and one consumer thread; push fails when full, pop fails when empty
+// Each index is written by one side only, so acquire/release ordering on the indices is all the synchronization needed
+template <typename T, size_t Capacity>
+struct SpscQueue {
+	T items[Capacity];
+
+	// separate cache lines keep the two threads from invalidating each other's index on every operation
+	alignas(64) std::atomic<size_t> head{ 0 }; // next item to pop; written by the consumer
+	alignas(64) std::atomic<size_t> tail{ 0 }; // next slot to push; written by the producer
+
+	bool push(T&& item)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == Capacity)
+			return false;
+
+		items[t % Capacity] = std::move(item);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& item)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+
+		item = std::move(items[h % Capacity]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+};
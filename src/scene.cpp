@@ -0,0 +1,372 @@
+#include "common.h"
+#include "mesh.h"
+#include "scene.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include <meshoptimizer.h>
+
+void splitMesh(std::vector<MeshChunk>& result, const std::shared_ptr<const MeshData>& mesh, size_t chunkTriangles)
+{
+	size_t chunkIndices = chunkTriangles * 3;
+	size_t chunkCount = std::max(size_t(1), (mesh->indices.size() + chunkIndices - 1) / chunkIndices);
+
+	size_t firstChunk = result.size();
+	uint32_t vertexEnd = 0;
+
+	for (size_t i = 0; i < chunkCount; ++i) {
+		MeshChunk chunk = {};
+		chunk.mesh = mesh;
+		chunk.indexBegin = uint32_t(i * chunkIndices);
+		chunk.indexEnd = uint32_t(std::min(mesh->indices.size(), (i + 1) * chunkIndices));
+		chunk.vertexBegin = vertexEnd;
+
+		for (uint32_t j = chunk.indexBegin; j < chunk.indexEnd; ++j)
+			vertexEnd = std::max(vertexEnd, mesh->indices[j] + 1);
+
+		// vertices are ordered by first use after optimizeMesh, so chunks mostly bring their own vertices; the last one takes any unreferenced leftovers
+		if (i == chunkCount - 1)
+			vertexEnd = uint32_t(mesh->vertices.size());
+
+		chunk.vertexEnd = vertexEnd;
+
+		result.push_back(chunk);
+	}
+
+	// meshlets go to the first chunk that has all of their vertices; meshlets stay in order so chunk ranges stay contiguous
+	size_t chunkIndex = firstChunk;
+
+	for (size_t i = 0; i < mesh->meshlets.size(); ++i) {
+		const Meshlet& meshlet = mesh->meshlets[i];
+		uint32_t meshletVertexEnd = 0;
+
+		for (unsigned int k = 0; k < meshlet.vertexCount; ++k)
+			meshletVertexEnd = std::max(meshletVertexEnd, mesh->meshletVertices[meshlet.vertexOffset + k] + 1);
+
+		while (result[chunkIndex].vertexEnd < meshletVertexEnd)
+			chunkIndex++;
+
+		result[chunkIndex].meshletEnd = uint32_t(i + 1);
+	}
+
+	uint32_t meshletEnd = 0;
+
+	for (size_t i = firstChunk; i < result.size(); ++i) {
+		result[i].meshletBegin = meshletEnd;
+		result[i].meshletEnd = std::max(result[i].meshletEnd, meshletEnd);
+		meshletEnd = result[i].meshletEnd;
+	}
+}
+
+// Meshlet data is stored in meshlet order, so the data of meshlets [begin, end) starts at the data of begin and ends at the data of end
+static uint32_t getMeshletVertexBegin(const MeshData& mesh, uint32_t meshlet)
+{
+	return meshlet < mesh.meshlets.size() ? mesh.meshlets[meshlet].vertexOffset : uint32_t(mesh.meshletVertices.size());
+}
+
+static uint32_t getMeshletTriangleBegin(const MeshData& mesh, uint32_t meshlet)
+{
+	return meshlet < mesh.meshlets.size() ? mesh.meshlets[meshlet].triangleOffset : uint32_t(mesh.meshletTriangles.size());
+}
+
+uint32_t packCone(const int8_t axis[3], int8_t cutoff)
+{
+	return uint32_t(uint8_t(axis[0])) | (uint32_t(uint8_t(axis[1])) << 8) | (uint32_t(uint8_t(axis[2])) << 16) | (uint32_t(uint8_t(cutoff)) << 24);
+}
+
+// Grows sphere until it contains the other one
+static void mergeSphere(MeshletSphere& sphere, const float* center, float radius)
+{
+	vec3 offset = { center[0] - sphere.center[0], center[1] - sphere.center[1], center[2] - sphere.center[2] };
+	float distance = length(offset);
+
+	if (distance + radius <= sphere.radius)
+		return;
+
+	if (distance + sphere.radius <= radius) {
+		memcpy(sphere.center, center, sizeof(sphere.center));
+		sphere.radius = radius;
+		return;
+	}
+
+	// the merged sphere touches the far sides of both
+	float mergedRadius = (distance + sphere.radius + radius) * 0.5f;
+	float shift = (mergedRadius - sphere.radius) / distance;
+
+	sphere.center[0] += offset.x * shift;
+	sphere.center[1] += offset.y * shift;
+	sphere.center[2] += offset.z * shift;
+	sphere.radius = mergedRadius;
+}
+
+// Bounding sphere and normal cone of a run of meshlets, packed like the meshlet cones
+// A meshlet's cutoff is the sine of its normal cone's half angle, so the merged half angle is the largest of axis angle plus half angle;
+// like meshopt_computeMeshletBounds, cones wider than acos(0.1) from the axis are not worth testing
+static void buildMeshletGroup(MeshletSphere& sphere, uint32_t& cone, const Meshlet* meshlets, size_t count)
+{
+	assert(count > 0);
+
+	sphere.center[0] = meshlets[0].center[0];
+	sphere.center[1] = meshlets[0].center[1];
+	sphere.center[2] = meshlets[0].center[2];
+	sphere.radius = meshlets[0].radius;
+
+	vec3 axis = {};
+	bool degenerate = false;
+
+	for (size_t i = 0; i < count; ++i) {
+		mergeSphere(sphere, meshlets[i].center, meshlets[i].radius);
+
+		axis = axis + vec3{ meshlets[i].coneAxis[0], meshlets[i].coneAxis[1], meshlets[i].coneAxis[2] };
+		degenerate |= meshlets[i].coneCutoff >= 1.f;
+	}
+
+	const int8_t kNoAxis[3] = {};
+	cone = packCone(kNoAxis, 127);
+
+	float axisLength = length(axis);
+
+	if (degenerate || axisLength == 0.f)
+		return;
+
+	axis = axis * (1.f / axisLength);
+
+	float angle = 0.f;
+
+	for (size_t i = 0; i < count; ++i) {
+		float axisDot = dot(axis, vec3{ meshlets[i].coneAxis[0], meshlets[i].coneAxis[1], meshlets[i].coneAxis[2] });
+		angle = std::max(angle, acosf(std::min(std::max(axisDot, -1.f), 1.f)) + asinf(meshlets[i].coneCutoff));
+	}
+
+	if (cosf(angle) <= 0.1f)
+		return;
+
+	float cutoff = sinf(angle);
+
+	// the quantized axis is off by up to the sum of its errors, which the cutoff has to absorb; same as meshopt_computeMeshletBounds
+	int8_t axisS8[3] = {
+		int8_t(meshopt_quantizeSnorm(axis.x, 8)),
+		int8_t(meshopt_quantizeSnorm(axis.y, 8)),
+		int8_t(meshopt_quantizeSnorm(axis.z, 8)),
+	};
+
+	float axisError = fabsf(axisS8[0] / 127.f - axis.x) + fabsf(axisS8[1] / 127.f - axis.y) + fabsf(axisS8[2] / 127.f - axis.z);
+	int cutoffS8 = std::min(int(127 * (cutoff + axisError) + 1), 127);
+
+	cone = packCone(axisS8, int8_t(cutoffS8));
+}
+
+// Groups are built from the whole mesh when its first chunk arrives, so they already cover meshlets that are still streaming in
+static void appendMeshletGroups(Scene& scene, const MeshData& mesh)
+{
+	for (const MeshLod& lod : mesh.lods) {
+		scene.lodGroupOffsets.push_back(uint32_t(scene.groupSpheres.size()));
+
+		for (uint32_t begin = 0; begin < lod.meshletCount; begin += kMeshletGroupSize) {
+			uint32_t end = std::min(begin + kMeshletGroupSize, lod.meshletCount);
+
+			MeshletSphere sphere;
+			uint32_t cone;
+			buildMeshletGroup(sphere, cone, &mesh.meshlets[lod.meshletOffset + begin], end - begin);
+
+			scene.groupSpheres.push_back(sphere);
+			scene.groupCones.push_back(cone);
+		}
+	}
+}
+
+void appendMeshChunk(Scene& scene, const MeshChunk& chunk, uint32_t instanceCount)
+{
+	const MeshData& mesh = *chunk.mesh;
+
+	if (chunk.indexBegin == 0) {
+		assert(scene.vertices.size() + mesh.vertices.size() <= ~0u);
+
+		MeshRange range = {};
+		range.vertexOffset = uint32_t(scene.vertices.size());
+		range.indexOffset = uint32_t(scene.indices.size());
+		range.meshletOffset = uint32_t(scene.meshlets.size());
+		range.meshletVertexOffset = uint32_t(scene.meshletVertices.size());
+		range.meshletTriangleOffset = uint32_t(scene.meshletTriangles.size());
+		range.lodOffset = uint32_t(scene.lods.size());
+		range.lodCount = uint32_t(mesh.lods.size());
+		range.center[0] = mesh.center[0];
+		range.center[1] = mesh.center[1];
+		range.center[2] = mesh.center[2];
+		range.radius = mesh.radius;
+
+		scene.meshes.push_back(range);
+		scene.lods.insert(scene.lods.end(), mesh.lods.begin(), mesh.lods.end());
+
+		appendMeshletGroups(scene, mesh);
+
+		// meshes are scaled to a unit bounding sphere; the instances of a mesh fill a square grid that extends along -Z, and the grids
+		// of all meshes are lined up along X in load order, so a single instance per mesh lines the meshes up along X
+		float scale = mesh.radius > 0.f ? 1.f / mesh.radius : 1.f;
+		uint32_t meshIndex = uint32_t(scene.meshes.size() - 1);
+		uint32_t gridSize = uint32_t(ceil(sqrt(double(instanceCount))));
+
+		uint32_t meshletVisibilityCount = 0;
+		for (const MeshLod& lod : mesh.lods)
+			meshletVisibilityCount = std::max(meshletVisibilityCount, lod.meshletCount);
+
+		// visibility is a bit per meshlet, and every draw starts on a word so that a group of kMeshletGroupSize meshlets fills one word
+		size_t meshletVisibilityBits = (size_t(meshletVisibilityCount) + 31) & ~size_t(31);
+
+		// offsets are 32-bit; instances that would not fit are dropped instead of aliasing the visibility of earlier draws
+		size_t instanceLimit = meshletVisibilityBits ? (size_t(~0u) - scene.meshletVisibilityCount) / meshletVisibilityBits : instanceCount;
+
+		if (instanceCount > instanceLimit) {
+			printf("Warning: mesh %d only has room for %d of %d instances, meshlet visibility is limited to 2^32 bits\n", int(meshIndex), int(instanceLimit), int(instanceCount));
+			instanceCount = uint32_t(instanceLimit);
+		}
+
+		for (uint32_t i = 0; i < instanceCount; ++i) {
+			MeshDraw draw = {};
+			draw.position[0] = float(meshIndex * gridSize + i % gridSize) * 2.5f - mesh.center[0] * scale;
+			draw.position[1] = -mesh.center[1] * scale;
+			draw.position[2] = -float(i / gridSize) * 2.5f - mesh.center[2] * scale;
+			draw.scale = scale;
+			draw.orientation[3] = 1.f;
+			draw.positionOffset[0] = mesh.positionOffset[0];
+			draw.positionOffset[1] = mesh.positionOffset[1];
+			draw.positionOffset[2] = mesh.positionOffset[2];
+			draw.positionScale = mesh.positionScale;
+			draw.center[0] = mesh.center[0];
+			draw.center[1] = mesh.center[1];
+			draw.center[2] = mesh.center[2];
+			draw.radius = mesh.radius;
+			draw.meshIndex = meshIndex;
+			draw.meshletVisibilityOffset = uint32_t(scene.meshletVisibilityCount);
+
+			scene.meshletVisibilityCount += meshletVisibilityBits;
+
+			scene.draws.push_back(draw);
+		}
+	}
+
+	MeshRange& range = scene.meshes.back();
+	assert(range.vertexCount == chunk.vertexBegin && range.indexCount == chunk.indexBegin && range.meshletCount == chunk.meshletBegin);
+
+	scene.vertices.insert(scene.vertices.end(), mesh.vertices.begin() + chunk.vertexBegin, mesh.vertices.begin() + chunk.vertexEnd);
+
+	// indices stay mesh-relative since indexed draws add vertexOffset themselves
+	scene.indices.insert(scene.indices.end(), mesh.indices.begin() + chunk.indexBegin, mesh.indices.begin() + chunk.indexEnd);
+
+	uint32_t meshletVertexBegin = getMeshletVertexBegin(mesh, chunk.meshletBegin);
+	uint32_t meshletVertexEnd = getMeshletVertexBegin(mesh, chunk.meshletEnd);
+	uint32_t meshletTriangleBegin = getMeshletTriangleBegin(mesh, chunk.meshletBegin);
+	uint32_t meshletTriangleEnd = getMeshletTriangleBegin(mesh, chunk.meshletEnd);
+
+	assert(range.meshletVertexOffset + meshletVertexBegin == scene.meshletVertices.size());
+	assert(range.meshletTriangleOffset + meshletTriangleBegin == scene.meshletTriangles.size());
+
+	for (uint32_t i = chunk.meshletBegin; i < chunk.meshletEnd; ++i) {
+		Meshlet meshlet = mesh.meshlets[i];
+		meshlet.vertexOffset += range.meshletVertexOffset;
+		meshlet.triangleOffset += range.meshletTriangleOffset;
+
+		scene.meshlets.push_back(meshlet);
+
+		MeshletSphere sphere = { { meshlet.center[0], meshlet.center[1], meshlet.center[2] }, meshlet.radius };
+		scene.meshletSpheres.push_back(sphere);
+		scene.meshletCones.push_back(packCone(meshlet.coneAxisS8, meshlet.coneCutoffS8));
+	}
+
+	// meshlets have no equivalent of vertexOffset, so their vertex references are rebased here
+	for (uint32_t i = meshletVertexBegin; i < meshletVertexEnd; ++i)
+		scene.meshletVertices.push_back(mesh.meshletVertices[i] + range.vertexOffset);
+
+	scene.meshletTriangles.insert(scene.meshletTriangles.end(), mesh.meshletTriangles.begin() + meshletTriangleBegin, mesh.meshletTriangles.begin() + meshletTriangleEnd);
+
+	range.vertexCount = chunk.vertexEnd;
+	range.indexCount = chunk.indexEnd;
+	range.meshletCount = chunk.meshletEnd;
+}
+
+// Largest error, in mesh units, that the mesh can have at its distance from the camera
+static float getMaxError(const MeshRange& range, const MeshDraw& draw, vec3 cameraPosition, float lodThreshold)
+{
+	quat orientation = { draw.orientation[0], draw.orientation[1], draw.orientation[2], draw.orientation[3] };
+	vec3 center = rotate(vec3{ range.center[0], range.center[1], range.center[2] } * draw.scale, orientation) + vec3{ draw.position[0], draw.position[1], draw.position[2] };
+
+	// the closest point of the bounding sphere is where the error projects largest; inside the sphere only the full mesh will do
+	float distance = std::max(length(center - cameraPosition) - range.radius * draw.scale, 0.f);
+
+	return lodThreshold * distance / draw.scale;
+}
+
+static const MeshLod& selectLod(const Scene& scene, const MeshRange& range, float maxError)
+{
+	assert(range.lodCount > 0);
+
+	uint32_t result = 0;
+
+	// LODs stream in after the full mesh, which is drawn partially until then
+	for (uint32_t i = 1; i < range.lodCount; ++i) {
+		const MeshLod& lod = scene.lods[range.lodOffset + i];
+
+		bool complete = lod.indexOffset + lod.indexCount <= range.indexCount && lod.meshletOffset + lod.meshletCount <= range.meshletCount;
+
+		if (complete && lod.error <= maxError)
+			result = i;
+	}
+
+	return scene.lods[range.lodOffset + result];
+}
+
+void buildLodRanges(std::vector<MeshLods>& meshes, std::vector<LodRange>& lods, const Scene& scene)
+{
+	meshes.resize(scene.meshes.size());
+	lods.clear();
+
+	for (size_t i = 0; i < scene.meshes.size(); ++i) {
+		const MeshRange& range = scene.meshes[i];
+
+		meshes[i].lodOffset = uint32_t(lods.size());
+
+		for (uint32_t j = 0; j < range.lodCount; ++j) {
+			const MeshLod& lod = scene.lods[range.lodOffset + j];
+
+			bool complete = lod.indexOffset + lod.indexCount <= range.indexCount && lod.meshletOffset + lod.meshletCount <= range.meshletCount;
+
+			if (j > 0 && !complete)
+				break;
+
+			LodRange result = {};
+			result.firstIndex = range.indexOffset + lod.indexOffset;
+			result.indexCount = lod.indexCount;
+			result.meshletOffset = range.meshletOffset + lod.meshletOffset;
+			result.meshletCount = std::min(lod.meshletCount, range.meshletCount - lod.meshletOffset);
+			result.groupOffset = scene.lodGroupOffsets[range.lodOffset + j];
+			result.error = lod.error;
+
+			lods.push_back(result);
+		}
+
+		meshes[i].lodCount = uint32_t(lods.size()) - meshes[i].lodOffset;
+	}
+}
+
+void buildMeshTaskCommands(std::vector<MeshTaskCommand>& result, const Scene& scene, vec3 cameraPosition, float lodThreshold, bool meshShaderNV)
+{
+	result.resize(scene.draws.size());
+
+	for (size_t i = 0; i < scene.draws.size(); ++i) {
+		const MeshRange& range = scene.meshes[scene.draws[i].meshIndex];
+		const MeshLod& lod = selectLod(scene, range, getMaxError(range, scene.draws[i], cameraPosition, lodThreshold));
+
+		// gl_WorkGroupID counts from 0 in the task shader, so the meshlet range is carried in the command
+		MeshTaskCommand& command = result[i];
+		command.meshletOffset = range.meshletOffset + lod.meshletOffset;
+		command.meshletCount = std::min(lod.meshletCount, range.meshletCount - lod.meshletOffset);
+		command.taskCount = (command.meshletCount + kMeshletGroupSize - 1) / kMeshletGroupSize;
+		command.taskCountY = meshShaderNV ? 0 : 1; // firstTask for NV
+		command.taskCountZ = 1;
+		command.groupOffset = scene.lodGroupOffsets[&lod - scene.lods.data()];
+		command.drawId = uint32_t(i);
+		command.drawVisibility = 1;
+	}
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "mesh.h"
+#include "vecmath.h"
+
+#include <memory>
+
+// Location of one mesh inside the shared scene buffers; offsets are in elements, not bytes
+// Counts cover what has been appended so far, which is less than the whole mesh while it streams in
+struct MeshRange {
+	uint32_t vertexOffset;
+	uint32_t vertexCount;
+	uint32_t indexOffset;
+	uint32_t indexCount;
+	uint32_t meshletOffset;
+	uint32_t meshletCount;
+	uint32_t meshletVertexOffset;
+	uint32_t meshletTriangleOffset;
+	uint32_t lodOffset;
+	uint32_t lodCount;
+
+	// bounding sphere in the units positions decode to, before the draw transform
+	float center[3];
+	float radius;
+};
+
+// Per-draw shader data, indexed by the draw index; a mesh can have any number of draws, each with its own transform; mirrors MeshDraw in shaders/mesh.h
+// World positions are rotate(decoded * scale, orientation) + position
+struct MeshDraw {
+	float position[3];
+	float scale;
+	float orientation[4]; // unit quaternion, xyzw
+	float positionOffset[3]; // see Mesh::positionOffset
+	float positionScale;
+	float center[3]; // same as MeshRange::center, for culling on the GPU
+	float radius;
+	uint32_t meshIndex; // into Scene::meshes and the MeshLods that buildLodRanges builds
+	uint32_t meshletVisibilityOffset; // bit offset into the meshlet visibility of occlusion culling, see Scene::meshletVisibilityCount
+	uint32_t padding[2]; // shaders/mesh.h rounds the struct up to a multiple of 16 bytes
+};
+
+// Bounding sphere of a meshlet; mirrors the MeshletSpheres buffer in shaders/mesh.h
+struct MeshletSphere {
+	float center[3];
+	float radius;
+};
+
+struct Scene {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> meshletVertices;
+	std::vector<uint8_t> meshletTriangles;
+
+	// what culling reads of every meshlet, 20 bytes instead of the whole header: the sphere, and the cone as packCone packs
+	// Meshlet::coneAxisS8 and coneCutoffS8; shaders only read the headers of meshlets that pass
+	std::vector<MeshletSphere> meshletSpheres;
+	std::vector<uint32_t> meshletCones;
+
+	// the same for every group of kMeshletGroupSize meshlets of a LOD, which is what one task workgroup covers; groups of a LOD start at lodGroupOffsets
+	// a group covers all of its meshlets even while some of them are still streaming in
+	std::vector<MeshletSphere> groupSpheres;
+	std::vector<uint32_t> groupCones;
+	std::vector<uint32_t> lodGroupOffsets; // one per entry of lods
+
+	std::vector<MeshRange> meshes;
+	std::vector<MeshDraw> draws;
+	std::vector<MeshLod> lods; // offsets are relative to the mesh's MeshRange
+
+	// occlusion culling keeps the visibility of every meshlet of every draw, one bit per meshlet of the largest LOD of the draw's mesh, rounded up to whole words
+	size_t meshletVisibilityCount = 0;
+};
+
+// Part of a mesh that can be added to the scene on its own, so that large meshes reach the GPU over several frames
+// Ranges index into mesh; the indices and meshlets of a chunk only reference vertices below vertexEnd
+struct MeshChunk {
+	std::shared_ptr<const MeshData> mesh;
+
+	uint32_t vertexBegin, vertexEnd;
+	uint32_t indexBegin, indexEnd;
+	uint32_t meshletBegin, meshletEnd;
+};
+
+// Appends chunks of about chunkTriangles triangles each that cover the whole mesh
+void splitMesh(std::vector<MeshChunk>& result, const std::shared_ptr<const MeshData>& mesh, size_t chunkTriangles);
+
+// Meshlets per task workgroup
+const uint32_t kMeshletGroupSize = 32;
+
+// Cone axis xyz and cutoff as 4 snorm8 bytes, x in the lowest byte, for unpackSnorm4x8
+uint32_t packCone(const int8_t axis[3], int8_t cutoff);
+
+// Chunks of a mesh have to be appended in order and without chunks of other meshes in between; the first chunk adds instanceCount draws of the mesh
+void appendMeshChunk(Scene& scene, const MeshChunk& chunk, uint32_t instanceCount = 1);
+
+// Indirect command for vkCmdDrawMeshTasksIndirectEXT that also carries the meshlet range for the task shader; mirrors MeshTaskCommand in shaders/mesh.h
+// vkCmdDrawMeshTasksIndirectNV reads the first two fields as taskCount and firstTask, so taskCountY is 0 in commands built for NV
+// Meshlets are not padded to whole task groups, so the task shader needs meshletCount to skip the tail of the last group
+struct MeshTaskCommand {
+	uint32_t taskCount;
+	uint32_t taskCountY;
+	uint32_t taskCountZ;
+	uint32_t meshletOffset;
+	uint32_t meshletCount;
+	uint32_t groupOffset; // into Scene::groupSpheres/groupCones, one group per task workgroup
+	uint32_t drawId; // into Scene::draws
+	uint32_t drawVisibility; // see MeshTaskCommand in shaders/mesh.h
+};
+
+// LODs of a mesh for the LOD selection in drawcull.comp.glsl; mirrors MeshLods in shaders/mesh.h
+struct MeshLods {
+	uint32_t lodOffset; // into the LodRanges
+	uint32_t lodCount;
+};
+
+// One LOD with scene offsets; mirrors LodRange in shaders/mesh.h
+struct LodRange {
+	uint32_t firstIndex; // into Scene::indices
+	uint32_t indexCount; // of the whole LOD even while it streams in, see LodRange in shaders/mesh.h
+	uint32_t meshletOffset; // into Scene::meshlets
+	uint32_t meshletCount;
+	uint32_t groupOffset; // into Scene::groupSpheres/groupCones
+	float error;
+};
+
+// What the GPU selects LODs from: the full mesh, with the meshlets that have been appended so far, and the LODs after it that have been appended
+// completely; LODs stream in order, so those are a prefix. Only changes when chunks arrive
+void buildLodRanges(std::vector<MeshLods>& meshes, std::vector<LodRange>& lods, const Scene& scene);
+
+// Every draw gets one command, with the coarsest LOD, out of the LODs that have been appended completely, whose error stays below lodThreshold * distance
+// lodThreshold is the error allowed at distance 1 from the camera, e.g. the size of a pixel there; 0 always selects the full mesh
+// The GPU path selects LODs the same way in drawcull.comp.glsl; these are the commands of CPU culling
+void buildMeshTaskCommands(std::vector<MeshTaskCommand>& result, const Scene& scene, vec3 cameraPosition, float lodThreshold, bool meshShaderNV = false);
@@ -7,10 +7,8 @@
 
 struct Id
 {
-	enum Kind {Unknown, Variable};
-
-	Kind kind = Unknown;
-	uint32_t type;
+	uint32_t opcode; // of the instruction that defines the id; 0 until one is seen
+	uint32_t typeId; // pointee of a pointer type, type of a variable
 	uint32_t storageClass;
 	uint32_t binding;
 	uint32_t set;
@@ -23,9 +21,13 @@ static VkShaderStageFlagBits getShaderStage(SpvExecutionModel executionModel) {
 	case SpvExecutionModelFragment:
 		return VK_SHADER_STAGE_FRAGMENT_BIT;
 	case SpvExecutionModelTaskNV:
-		return VK_SHADER_STAGE_TASK_BIT_NV;
+	case SpvExecutionModelTaskEXT:
+		return VK_SHADER_STAGE_TASK_BIT_EXT;
 	case SpvExecutionModelMeshNV:
-		return VK_SHADER_STAGE_MESH_BIT_NV;
+	case SpvExecutionModelMeshEXT:
+		return VK_SHADER_STAGE_MESH_BIT_EXT;
+	case SpvExecutionModelGLCompute:
+		return VK_SHADER_STAGE_COMPUTE_BIT;
 
 	default:
 		assert(!"Unsupported execution model");
@@ -33,6 +35,22 @@ static VkShaderStageFlagBits getShaderStage(SpvExecutionModel executionModel) {
 	}
 }
 
+// Buffer blocks are always storage buffers; uniform buffers are not used, push constants carry the per-frame data
+static VkDescriptorType getDescriptorType(uint32_t opcode) {
+	switch (opcode) {
+	case SpvOpTypeStruct:
+		return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	case SpvOpTypeImage:
+		return VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	case SpvOpTypeSampledImage:
+		return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+	default:
+		assert(!"Unsupported resource type");
+		return VK_DESCRIPTOR_TYPE_MAX_ENUM;
+	}
+}
+
 static void parseShader(Shader& shader, const uint32_t* code, uint32_t codeSize) {
 	assert(code[0] == SpvMagicNumber);
 	
@@ -72,6 +90,33 @@ static void parseShader(Shader& shader, const uint32_t* code, uint32_t codeSize)
 			}
 		}
 		break;
+		case SpvOpTypeStruct:
+		case SpvOpTypeImage:
+		case SpvOpTypeSampler:
+		case SpvOpTypeSampledImage:
+		{
+			assert(wordCount >= 2);
+
+			uint32_t id = insn[1];
+			assert(id < idBound);
+
+			assert(ids[id].opcode == 0);
+			ids[id].opcode = opcode;
+		}
+		break;
+		case SpvOpTypePointer:
+		{
+			assert(wordCount == 4);
+
+			uint32_t id = insn[1];
+			assert(id < idBound);
+
+			assert(ids[id].opcode == 0);
+			ids[id].opcode = opcode;
+			ids[id].typeId = insn[3];
+			ids[id].storageClass = insn[2];
+		}
+		break;
 		case SpvOpVariable:
 		{
 			assert(wordCount >= 4);
@@ -79,9 +124,9 @@ static void parseShader(Shader& shader, const uint32_t* code, uint32_t codeSize)
 			uint32_t id = insn[2];
 			assert(id < idBound);
 
-			assert(ids[id].kind == Id::Unknown);
-			ids[id].kind = Id::Variable;
-			ids[id].type = insn[1];
+			assert(ids[id].opcode == 0);
+			ids[id].opcode = opcode;
+			ids[id].typeId = insn[1];
 			ids[id].storageClass = insn[3];
 		}
 		break;
@@ -92,12 +137,16 @@ static void parseShader(Shader& shader, const uint32_t* code, uint32_t codeSize)
 	}
 
 	for (auto& id : ids) {
-		if (id.kind == Id::Variable && id.storageClass == SpvStorageClassUniform) {
+		if (id.opcode == SpvOpVariable && (id.storageClass == SpvStorageClassUniform || id.storageClass == SpvStorageClassUniformConstant || id.storageClass == SpvStorageClassStorageBuffer)) {
 			assert(id.set == 0);
 			assert(id.binding < 32);
-			assert((shader.storageBufferMask & (1 << id.binding)) == 0);
+			assert((shader.resourceMask & (1 << id.binding)) == 0);
 
-			shader.storageBufferMask |= 1 << id.binding;
+			assert(ids[id.typeId].opcode == SpvOpTypePointer);
+			uint32_t typeKind = ids[ids[id.typeId].typeId].opcode;
+
+			shader.resourceTypes[id.binding] = getDescriptorType(typeKind);
+			shader.resourceMask |= 1 << id.binding;
 		}
 	}
 }
@@ -140,24 +189,42 @@ void destroyShader(Shader& shader, VkDevice device) {
 	vkDestroyShaderModule(device, shader.module, 0);
 }
 
-VkDescriptorSetLayout createSetLayout(VkDevice device, Shaders shaders) {
-	std::vector<VkDescriptorSetLayoutBinding> setBinding = {};
+static uint32_t gatherResources(Shaders shaders, VkDescriptorType (&resourceTypes)[32]) {
+	uint32_t resourceMask = 0;
 
-	uint32_t storageBufferMask = 0;
 	for (const Shader* shader : shaders) {
-		storageBufferMask |= shader->storageBufferMask;
+		for (uint32_t i = 0; i < 32; ++i) {
+			if (shader->resourceMask & (1 << i)) {
+				if (resourceMask & (1 << i)) {
+					assert(resourceTypes[i] == shader->resourceTypes[i]);
+				}
+				else {
+					resourceTypes[i] = shader->resourceTypes[i];
+					resourceMask |= 1 << i;
+				}
+			}
+		}
 	}
 
+	return resourceMask;
+}
+
+VkDescriptorSetLayout createSetLayout(VkDevice device, Shaders shaders) {
+	std::vector<VkDescriptorSetLayoutBinding> setBinding = {};
+
+	VkDescriptorType resourceTypes[32] = {};
+	uint32_t resourceMask = gatherResources(shaders, resourceTypes);
+
 	for (uint32_t i = 0; i < 32; ++i) {
-		if (storageBufferMask & (1 << i)) {
+		if (resourceMask & (1 << i)) {
 			VkDescriptorSetLayoutBinding binding = {};
 			binding.binding = i;
-			binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			binding.descriptorType = resourceTypes[i];
 			binding.descriptorCount = 1;
 
 			binding.stageFlags = 0;
 			for (const Shader* shader : shaders) {
-				if (shader->storageBufferMask & (1 << i)) {
+				if (shader->resourceMask & (1 << i)) {
 					binding.stageFlags |= shader->stage;
 				}
 			}
@@ -177,12 +244,21 @@ VkDescriptorSetLayout createSetLayout(VkDevice device, Shaders shaders) {
 	return setLayout;
 }
 
-VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout setLayout)
+VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout setLayout, VkShaderStageFlags pushConstantStages, size_t pushConstantSize)
 {
 	VkPipelineLayoutCreateInfo createInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
 	createInfo.setLayoutCount = 1;
 	createInfo.pSetLayouts = &setLayout;
 
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = pushConstantStages;
+	pushConstantRange.size = uint32_t(pushConstantSize);
+
+	if (pushConstantSize) {
+		createInfo.pushConstantRangeCount = 1;
+		createInfo.pPushConstantRanges = &pushConstantRange;
+	}
+
 	VkPipelineLayout layout = 0;
 	VK_CHECK(vkCreatePipelineLayout(device, &createInfo, 0, &layout));
 
@@ -192,18 +268,16 @@ VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout set
 VkDescriptorUpdateTemplate createUpdateTemplate(VkDevice device, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, Shaders shaders) {
 	std::vector<VkDescriptorUpdateTemplateEntry> entries;
 
-	uint32_t storageBufferMask = 0;
-	for (const Shader* shader : shaders) {
-		storageBufferMask |= shader->storageBufferMask;
-	}
+	VkDescriptorType resourceTypes[32] = {};
+	uint32_t resourceMask = gatherResources(shaders, resourceTypes);
 
 	for (uint32_t i = 0; i < 32; ++i) {
-		if (storageBufferMask & (1 << i)) {
+		if (resourceMask & (1 << i)) {
 			VkDescriptorUpdateTemplateEntry entry = {};
 			entry.dstBinding = i;
 			entry.dstArrayElement = 0;
 			entry.descriptorCount = 1;
-			entry.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			entry.descriptorType = resourceTypes[i];
 			entry.offset = sizeof(DescriptorInfo) * i;
 			entry.stride = sizeof(DescriptorInfo);
 
@@ -226,10 +300,34 @@ VkDescriptorUpdateTemplate createUpdateTemplate(VkDevice device, VkPipelineBindP
 	return updateTemplate;
 }
 
-VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, Shaders shaders, VkPipelineLayout layout)
+// Constant i of the list becomes specialization constant i; shaders that do not declare it ignore it
+static VkSpecializationInfo fillSpecializationInfo(std::vector<VkSpecializationMapEntry>& entries, Constants constants)
+{
+	for (size_t i = 0; i < constants.size(); ++i) {
+		VkSpecializationMapEntry entry = {};
+		entry.constantID = uint32_t(i);
+		entry.offset = uint32_t(i * sizeof(int));
+		entry.size = sizeof(int);
+
+		entries.push_back(entry);
+	}
+
+	VkSpecializationInfo result = {};
+	result.mapEntryCount = uint32_t(entries.size());
+	result.pMapEntries = entries.data();
+	result.dataSize = constants.size() * sizeof(int);
+	result.pData = constants.begin();
+
+	return result;
+}
+
+VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, Shaders shaders, VkPipelineLayout layout, Constants constants)
 {
 	VkGraphicsPipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
 
+	std::vector<VkSpecializationMapEntry> specializationEntries;
+	VkSpecializationInfo specializationInfo = fillSpecializationInfo(specializationEntries, constants);
+
 	std::vector<VkPipelineShaderStageCreateInfo> stages;
 	for (const Shader* shader : shaders) {
 		VkPipelineShaderStageCreateInfo stage = {};
@@ -237,6 +335,7 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache
 		stage.stage = shader->stage;
 		stage.module = shader->module;
 		stage.pName = "main";
+		stage.pSpecializationInfo = &specializationInfo;
 
 		stages.push_back(stage);
 	}
@@ -258,7 +357,7 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache
 
 	VkPipelineRasterizationStateCreateInfo rasterizationState = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
 	rasterizationState.lineWidth = 1.f;
-	rasterizationState.frontFace = VK_FRONT_FACE_CLOCKWISE;
+	rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 	rasterizationState.cullMode = VK_CULL_MODE_BACK_BIT;
 	//rasterizationState.cullMode = VK_CULL_MODE_FRONT_BIT;
 	createInfo.pRasterizationState = &rasterizationState;
@@ -267,7 +366,11 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache
 	multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 	createInfo.pMultisampleState = &multisampleState;
 
+	// reversed depth: 1 at the near plane, 0 at infinity
 	VkPipelineDepthStencilStateCreateInfo depthStencilState = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+	depthStencilState.depthTestEnable = true;
+	depthStencilState.depthWriteEnable = true;
+	depthStencilState.depthCompareOp = VK_COMPARE_OP_GREATER;
 	createInfo.pDepthStencilState = &depthStencilState;
 
 	VkPipelineColorBlendAttachmentState colorAttachmentState = {};
@@ -293,3 +396,26 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache
 
 	return pipeline;
 }
+
+VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache, const Shader& shader, VkPipelineLayout layout, Constants constants)
+{
+	assert(shader.stage == VK_SHADER_STAGE_COMPUTE_BIT);
+
+	VkComputePipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+
+	std::vector<VkSpecializationMapEntry> specializationEntries;
+	VkSpecializationInfo specializationInfo = fillSpecializationInfo(specializationEntries, constants);
+
+	createInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	createInfo.stage.stage = shader.stage;
+	createInfo.stage.module = shader.module;
+	createInfo.stage.pName = "main";
+	createInfo.stage.pSpecializationInfo = &specializationInfo;
+
+	createInfo.layout = layout;
+
+	VkPipeline pipeline = 0;
+	VK_CHECK(vkCreateComputePipelines(device, pipelineCache, 1, &createInfo, 0, &pipeline));
+
+	return pipeline;
+}
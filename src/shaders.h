@@ -3,18 +3,23 @@
 struct Shader {
 	VkShaderModule module;
 	VkShaderStageFlagBits stage;
-	uint32_t storageBufferMask;
+
+	// descriptor type of every binding in resourceMask; all resources live in set 0
+	VkDescriptorType resourceTypes[32];
+	uint32_t resourceMask;
 };
 
 bool loadShader(Shader& shader, VkDevice device, const char* path);
 
 using Shaders = std::initializer_list<const Shader*>;
+using Constants = std::initializer_list<int>;
 
 void destroyShader(Shader& shader, VkDevice device);
 VkDescriptorSetLayout createSetLayout(VkDevice device, Shaders shaders);
-VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout setLayout);
+VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout setLayout, VkShaderStageFlags pushConstantStages, size_t pushConstantSize);
 VkDescriptorUpdateTemplate createUpdateTemplate(VkDevice device, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, Shaders shaders);
-VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, Shaders shaders, VkPipelineLayout layout);
+VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, Shaders shaders, VkPipelineLayout layout, Constants constants = {});
+VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache, const Shader& shader, VkPipelineLayout layout, Constants constants = {});
 
 struct DescriptorInfo {
 	union {
@@ -32,6 +37,12 @@ struct DescriptorInfo {
 		this->image.imageLayout = imageLayout;
 	}
 
+	DescriptorInfo(VkImageView imageView, VkImageLayout imageLayout) {
+		this->image.sampler = VK_NULL_HANDLE;
+		this->image.imageView = imageView;
+		this->image.imageLayout = imageLayout;
+	}
+
 	DescriptorInfo(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
 		this->buffer.buffer = buffer;
 		this->buffer.offset = offset;
@@ -0,0 +1,29 @@
+#version 450
+
+layout(local_size_x = 32, local_size_y = 32, local_size_z = 1) in;
+
+layout(binding = 0, r32f) uniform writeonly image2D outImage;
+layout(binding = 1) uniform sampler2D inImage;
+
+// Every texel of the output keeps the farthest depth of the input texels it covers; with reversed depth that is the smallest value
+// The first level is reduced from the full resolution depth buffer, which is usually not a power of two, so footprints can be up to 3x3 texels
+void main()
+{
+	ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 outSize = imageSize(outImage);
+
+	if (pos.x >= outSize.x || pos.y >= outSize.y)
+		return;
+
+	ivec2 inSize = textureSize(inImage, 0);
+	ivec2 begin = pos * inSize / outSize;
+	ivec2 end = ((pos + 1) * inSize + outSize - 1) / outSize;
+
+	float depth = 1.0;
+
+	for (int y = begin.y; y < end.y; ++y)
+		for (int x = begin.x; x < end.x; ++x)
+			depth = min(depth, texelFetch(inImage, ivec2(x, y), 0).x);
+
+	imageStore(outImage, pos, vec4(depth));
+}
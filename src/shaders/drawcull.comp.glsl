@@ -0,0 +1,160 @@
+#version 450
+
+#extension GL_EXT_shader_16bit_storage : require
+#extension GL_EXT_shader_8bit_storage : require
+#extension GL_EXT_shader_explicit_arithmetic_types : require
+
+#extension GL_GOOGLE_include_directive : require
+
+#include "mesh.h"
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+// 1 when the mesh path draws with VK_NV_mesh_shader, which reads the second word of a task command as firstTask
+layout(constant_id = 0) const bool MESH_NV = false;
+
+// Bound with the exact size so that length() is the draw count
+layout(binding = 0) readonly buffer Draws
+{
+	MeshDraw draws[];
+};
+
+layout(binding = 1) readonly buffer Meshes
+{
+	MeshLods meshes[];
+};
+
+layout(binding = 2) readonly buffer Lods
+{
+	LodRange lods[];
+};
+
+layout(binding = 3) writeonly buffer TaskCommands
+{
+	MeshTaskCommand taskCommands[];
+};
+
+layout(binding = 4) writeonly buffer CulledCommands
+{
+	DrawCommand culledCommands[];
+};
+
+layout(binding = 5) buffer Counts
+{
+	CullCounts counts;
+};
+
+// 1 for draws that passed all tests in the second pass of the previous frame
+layout(binding = 6) buffer DrawVisibility
+{
+	uint drawVisibility[];
+};
+
+layout(binding = 7) uniform sampler2D depthPyramid;
+
+layout(push_constant) uniform block
+{
+	Globals globals;
+};
+
+// Culls draws against the frustum, and in the second pass against the depth pyramid, selects the LOD of the visible ones and appends a command
+// for each path: a task command for the mesh path, and for the classic path an empty command that meshletcull.comp.glsl fills with the
+// triangles of visible meshlets; both are drawn with the count in CullCounts
+void main()
+{
+	uint di = gl_GlobalInvocationID.x;
+
+	if (di >= draws.length())
+		return;
+
+	MeshDraw draw = draws[di];
+
+	vec3 center = (globals.view * vec4(transformPosition(draw.center, draw), 1.0)).xyz;
+	float radius = draw.radius * draw.scale;
+
+	bool visible = sphereInFrustum(center, radius, globals.frustum, globals.projection);
+
+	if (visible && globals.late != 0 && globals.occlusion != 0)
+		visible = !occlusionCull(depthPyramid, center, radius, globals.projection);
+
+	// same two passes as for meshlets in meshlet.task.glsl, except that the second pass emits every visible draw: its meshlets that the
+	// first pass skipped are only found by testing them again
+	bool emit = visible;
+	uint previousVisibility = drawVisibility[di];
+
+	if (globals.occlusion != 0) {
+		if (globals.late != 0)
+			drawVisibility[di] = visible ? 1 : 0;
+		else
+			emit = visible && previousVisibility != 0;
+	}
+
+	if (!emit)
+		return;
+
+	// the camera is at the origin of view space; the closest point of the bounding sphere is where the error projects largest, see getMaxError in scene.cpp
+	MeshLods mesh = meshes[draw.meshIndex];
+
+	float distance = max(length(center) - radius, 0.0);
+	float maxError = globals.lodThreshold * distance / draw.scale;
+
+	uint lodIndex = 0;
+	for (uint i = 1; i < mesh.lodCount; ++i)
+		if (lods[mesh.lodOffset + i].error <= maxError)
+			lodIndex = i;
+
+	LodRange lod = lods[mesh.lodOffset + lodIndex];
+
+	uint ci = atomicAdd(counts.commandCount, 1);
+
+	// grows the meshletcull.comp.glsl dispatch to cover this command
+	atomicMax(counts.commandRows, min(ci + 1, kCommandRowSize));
+	atomicMax(counts.commandLayers, ci / kCommandRowSize + 1);
+
+	MeshTaskCommand taskCommand;
+	taskCommand.taskCount = (lod.meshletCount + kMeshletGroupSize - 1) / kMeshletGroupSize;
+	taskCommand.taskCountY = MESH_NV ? 0 : 1;
+	taskCommand.taskCountZ = 1;
+	taskCommand.meshletOffset = lod.meshletOffset;
+	taskCommand.meshletCount = lod.meshletCount;
+	taskCommand.groupOffset = lod.groupOffset;
+	taskCommand.drawId = di;
+	taskCommand.drawVisibility = previousVisibility;
+
+	taskCommands[ci] = taskCommand;
+
+	// meshlet triangles go into a range of the compacted index buffer with room for all of them, since draws of the same mesh can select
+	// the same LOD; meshlet vertex lists already hold scene vertex indices, so there is no vertex offset
+	// the range is only taken when it fits, so the count never passes the capacity and cannot wrap around
+	uint firstIndex = counts.compactedIndexCount;
+	bool fits = false;
+
+	while (lod.indexCount <= counts.compactedIndexCapacity - firstIndex) {
+		uint previous = atomicCompSwap(counts.compactedIndexCount, firstIndex, firstIndex + lod.indexCount);
+
+		if (previous == firstIndex) {
+			fits = true;
+			break;
+		}
+
+		firstIndex = previous;
+	}
+
+	if (!fits)
+		atomicAdd(counts.droppedCount, 1);
+
+	DrawCommand command;
+	command.indexCount = 0;
+	command.instanceCount = fits ? 1 : 0;
+	command.firstIndex = fits ? firstIndex : 0;
+	command.vertexOffset = 0;
+	command.firstInstance = di;
+
+	culledCommands[ci] = command;
+
+	if (globals.late != 0 || globals.occlusion == 0) {
+		atomicAdd(counts.drawCount, 1);
+		atomicAdd(counts.triangleCount, lod.indexCount / 3);
+		atomicAdd(counts.meshletCount, lod.meshletCount);
+	}
+}
@@ -1,15 +1,219 @@
-struct Vertex
+#include "vertex.h"
+
+struct MeshDraw
+{
+	vec3 position;
+	float scale;
+	vec4 orientation;
+	vec3 positionOffset;
+	float positionScale;
+	vec3 center; // bounding sphere before the draw transform
+	float radius;
+	uint meshIndex; // into MeshLods
+	uint meshletVisibilityOffset; // bit offset into MeshletVisibility, one bit per meshlet of the draw's largest LOD; LODs share them
+};
+
+// LODs of a mesh that drawcull.comp.glsl can select from; the first one is the full mesh, the others have arrived completely
+struct MeshLods
 {
-	float16_t vx, vy, vz, vw;
-	uint8_t nx, ny, nz, nw;
-	float16_t tu, tv;
+	uint lodOffset; // into LodRanges
+	uint lodCount;
+};
+
+// One LOD with scene offsets; the meshlet count of the full mesh covers what has arrived so far
+struct LodRange
+{
+	uint firstIndex; // into the index buffer
+	uint indexCount; // of the whole LOD, which is the room its meshlets need in the compacted index buffer
+	uint meshletOffset;
+	uint meshletCount;
+	uint groupOffset; // into GroupSpheres/GroupCones
+	float error;
 };
 
 struct Meshlet
 {
-	vec4 cone;
-	uint vertices[64];
-	uint8_t indices[126 * 3]; // up to 126 triangles
-	uint8_t triangleCount;
-	uint8_t vertexCount;
+	vec3 center;
+	float radius;
+	vec3 coneApex;
+	float coneCutoff;
+	vec3 coneAxis;
+	uint vertexOffset; // into meshletVertices
+	uint triangleOffset; // into meshletTriangles
+	uint8_t vertexCount; // up to 64
+	uint8_t triangleCount; // up to 126
+	int8_t coneAxisS8[3];
+	int8_t coneCutoffS8;
+};
+
+// Culling reads these instead of Meshlet: MeshletSpheres holds center and radius as a vec4, MeshletCones the cone axis and cutoff as
+// snorm8, see packCone in scene.h; only meshlets that pass load their headers
+// GroupSpheres and GroupCones hold the same for every 32 meshlets of a LOD, so that a workgroup can reject all of its meshlets with one test
+
+// Meshlets per task workgroup; see kMeshletGroupSize in scene.h
+const uint kMeshletGroupSize = 32;
+
+// Indirect command as laid out by buildMeshTaskCommands; the first three fields are consumed by the draw itself
+struct MeshTaskCommand
+{
+	uint taskCount;
+	uint taskCountY;
+	uint taskCountZ;
+	uint meshletOffset;
+	uint meshletCount;
+	uint groupOffset; // into GroupSpheres/GroupCones, one group of 32 meshlets per task workgroup
+	uint drawId; // commands are compacted by drawcull.comp.glsl, so the command index is not the draw index
+	uint drawVisibility; // in the second pass, 1 when the first pass drew this draw; the meshlets of the others are all drawn by the second pass
+};
+
+// VkDrawIndexedIndirectCommand
+struct DrawCommand
+{
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint firstInstance;
 };
+
+// Push constants of every pipeline
+struct Globals
+{
+	mat4 view; // world to view; the camera looks down -Z
+	vec4 projection; // P00, P11, znear, unused; infinite far plane with reversed depth
+	vec4 frustum; // normalized side planes in view space: (x, z) of the x plane, then (y, z) of the y plane; see sphereInFrustum
+	uint late; // 1 in the second pass, which tests against the depth pyramid and draws what the first pass missed
+	uint occlusion; // 0 turns off occlusion culling: the first pass draws everything and there is no second pass
+	vec2 screen; // framebuffer size in pixels
+	uint triangleCulling; // 1 culls backfacing, small and off-screen triangles in meshlet.mesh.glsl
+	float lodThreshold; // error allowed at distance 1 from the camera, see buildMeshTaskCommands in scene.h; 0 selects the full mesh
+};
+
+// Commands per row of the meshletcull.comp.glsl dispatch; the minimum maxComputeWorkGroupCount, so rows and layers of rows cover any command count
+const uint kCommandRowSize = 65535;
+
+// Written by drawcull.comp.glsl; the three fields after commandCount are the indirect dispatch of meshletcull.comp.glsl, a workgroup per group of
+// meshlets and command, and commandCount is also the draw count of the indirect draws; each pass resets them, the statistics are reset once per frame
+struct CullCounts
+{
+	uint commandCount;
+	uint maxTaskCount; // largest taskCount of any LOD, clamped to maxComputeWorkGroupCount[0]; meshletcull.comp.glsl loops over the rest
+	uint commandRows; // min(commandCount, kCommandRowSize)
+	uint commandLayers; // commandCount / kCommandRowSize, rounded up
+
+	// every command gets a range of the compacted index buffer; commands that do not fit are skipped by the classic path
+	uint compactedIndexCount;
+	uint compactedIndexCapacity;
+
+	// selected LODs of the draws that are visible after the last pass, before meshlet culling
+	uint drawCount;
+	uint triangleCount;
+	uint meshletCount;
+
+	// commands of either pass that the classic path skips for lack of room in the compacted index buffer
+	uint droppedCount;
+};
+
+vec3 rotateQuat(vec3 v, vec4 q)
+{
+	return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+vec3 transformPosition(vec3 v, MeshDraw draw)
+{
+	return rotateQuat(v * draw.scale, draw.orientation) + draw.position;
+}
+
+vec4 projectPosition(vec3 v, vec4 projection)
+{
+	return vec4(v.x * projection.x, v.y * projection.y, projection.z, -v.z);
+}
+
+// Camera is at the origin of view space; center and axis are in view space
+// The bounding sphere stands in for the apex, which keeps the quantized cutoff conservative (see meshopt_computeMeshletBounds)
+bool coneCull(vec3 center, float radius, vec3 axis, float cutoff)
+{
+	return dot(center, axis) >= cutoff * length(center) + radius;
+}
+
+// The frustum is symmetric, so one plane per axis covers both sides via abs(); there is no far plane
+bool sphereInFrustum(vec3 center, float radius, vec4 frustum, vec4 projection)
+{
+	return
+		abs(center.x) * frustum.x + center.z * frustum.y < radius &&
+		abs(center.y) * frustum.z + center.z * frustum.w < radius &&
+		center.z - radius < -projection.z;
+}
+
+// Bounds of a view space sphere in the uv space of the depth pyramid; fails when the sphere is not entirely beyond the near plane
+// 2D Polyhedral Bounds of a Clipped, Perspective-Projected 3D Sphere. Michael Mara, Morgan McGuire. 2013
+bool projectSphere(vec3 center, float radius, vec4 projection, out vec4 aabb)
+{
+	// the camera looks down -Z, the derivation assumes +Z
+	vec3 c = vec3(center.xy, -center.z);
+
+	if (c.z < radius + projection.z)
+		return false;
+
+	vec2 cx = c.xz;
+	vec2 vx = vec2(sqrt(dot(cx, cx) - radius * radius), radius);
+	vec2 minx = mat2(vx.x, vx.y, -vx.y, vx.x) * cx;
+	vec2 maxx = mat2(vx.x, -vx.y, vx.y, vx.x) * cx;
+
+	vec2 cy = c.yz;
+	vec2 vy = vec2(sqrt(dot(cy, cy) - radius * radius), radius);
+	vec2 miny = mat2(vy.x, vy.y, -vy.y, vy.x) * cy;
+	vec2 maxy = mat2(vy.x, -vy.y, vy.y, vy.x) * cy;
+
+	aabb = vec4(minx.x / minx.y * projection.x, miny.x / miny.y * projection.y, maxx.x / maxx.y * projection.x, maxy.x / maxy.y * projection.y);
+
+	// the viewport flips Y so that +Y is up, which puts the top of the screen at v = 0
+	aabb = aabb.xwzy * vec4(0.5, -0.5, 0.5, -0.5) + vec4(0.5);
+
+	return true;
+}
+
+// The pyramid stores the farthest depth of every texel's footprint, so a sphere whose nearest point is farther than that everywhere in its bounds is hidden
+bool occlusionCull(sampler2D depthPyramid, vec3 center, float radius, vec4 projection)
+{
+	vec4 aabb;
+	if (!projectSphere(center, radius, projection, aabb))
+		return false;
+
+	// on the level where the bounds are at most one texel wide they touch at most 2x2 texels
+	vec2 size = (aabb.zw - aabb.xy) * vec2(textureSize(depthPyramid, 0));
+	int level = clamp(int(ceil(log2(max(max(size.x, size.y), 1.0)))), 0, textureQueryLevels(depthPyramid) - 1);
+
+	ivec2 levelSize = textureSize(depthPyramid, level);
+	ivec2 texelMin = clamp(ivec2(aabb.xy * vec2(levelSize)), ivec2(0), levelSize - 1);
+	ivec2 texelMax = clamp(ivec2(aabb.zw * vec2(levelSize)), ivec2(0), levelSize - 1);
+
+	float depth = min(
+		min(texelFetch(depthPyramid, texelMin, level).x, texelFetch(depthPyramid, ivec2(texelMax.x, texelMin.y), level).x),
+		min(texelFetch(depthPyramid, ivec2(texelMin.x, texelMax.y), level).x, texelFetch(depthPyramid, texelMax, level).x));
+
+	float depthSphere = projection.z / (-center.z - radius);
+
+	return depthSphere < depth;
+}
+
+// Frustum and cone tests, and in the second pass the depth pyramid test; shared by meshlet.task.glsl and meshletcull.comp.glsl
+bool meshletVisible(vec4 sphere, uint cone, MeshDraw draw, Globals globals, sampler2D depthPyramid)
+{
+	vec3 center = (globals.view * vec4(transformPosition(sphere.xyz, draw), 1.0)).xyz;
+	float radius = sphere.w * draw.scale;
+
+	if (!sphereInFrustum(center, radius, globals.frustum, globals.projection))
+		return false;
+
+	vec4 coneData = unpackSnorm4x8(cone);
+	vec3 axis = mat3(globals.view) * rotateQuat(coneData.xyz, draw.orientation);
+
+	if (coneCull(center, radius, axis, coneData.w))
+		return false;
+
+	if (globals.late != 0 && globals.occlusion != 0 && occlusionCull(depthPyramid, center, radius, globals.projection))
+		return false;
+
+	return true;
+}
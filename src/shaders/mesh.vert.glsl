@@ -3,6 +3,7 @@
 #extension GL_EXT_shader_16bit_storage : require
 #extension GL_EXT_shader_8bit_storage : require
 #extension GL_EXT_shader_explicit_arithmetic_types : require
+#extension GL_ARB_shader_draw_parameters : require
 
 #extension GL_GOOGLE_include_directive : require
 
@@ -13,16 +14,31 @@ layout(binding = 0)readonly buffer Vertices
 	Vertex vertices[];
 };
 
+layout(binding = 1)readonly buffer Draws
+{
+	MeshDraw draws[];
+};
+
+layout(push_constant) uniform block
+{
+	Globals globals;
+};
+
 layout(location = 0)out vec4 color;
 
 void main() {
+	// firstInstance of every command is the draw index, since CPU culling can split a draw into several commands
+	MeshDraw draw = draws[gl_BaseInstanceARB];
 	Vertex v = vertices[gl_VertexIndex];
 
-	vec3 position = vec3(v.vx, v.vy, v.vz);
-	vec3 normal = vec3(v.nx, v.ny, v.nz) / 127.0 - 1.0;
-	vec2 texcoord = vec2(v.tu, v.tv);
+	vec3 position = decodePosition(v, vec4(draw.positionOffset, draw.positionScale));
+	vec3 normal = decodeNormal(v);
+	vec2 texcoord = decodeTexcoord(v);
+
+	vec3 world = transformPosition(position, draw);
+	normal = rotateQuat(normal, draw.orientation);
 
-	gl_Position = vec4(position + vec3(0.0,0.0,0.5), 1.0);
+	gl_Position = projectPosition((globals.view * vec4(world, 1.0)).xyz, globals.projection);
 
 	color = vec4(normal * 0.5 + vec3(0.5), 1.0);
 }
\ No newline at end of file
@@ -2,7 +2,11 @@
 
 #extension GL_EXT_shader_16bit_storage : require
 #extension GL_EXT_shader_8bit_storage : require
+#ifdef MESH_NV
 #extension GL_NV_mesh_shader : require
+#else
+#extension GL_EXT_mesh_shader : require
+#endif
 #extension GL_EXT_shader_explicit_arithmetic_types : require
 
 #extension GL_GOOGLE_include_directive : require
@@ -11,8 +15,16 @@
 
 #define DEBUG 1
 
-layout(local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
-layout(triangles, max_vertices = 64, max_primitives = 126) out;
+// output limits only take literals, so devices that cannot output 64 vertices and 126 triangles get a variant built with smaller ones
+// and meshlets built to match, see MeshletLimits
+#ifndef MESHLET_MAX_VERTICES
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 126
+#endif
+
+// lane count comes from the device's preferred mesh workgroup size as constant 1
+layout(local_size_x_id = 1) in;
+layout(triangles, max_vertices = MESHLET_MAX_VERTICES, max_primitives = MESHLET_MAX_TRIANGLES) out;
 
 layout(binding = 0)readonly buffer Vertices
 {
@@ -24,12 +36,50 @@ layout(binding = 1)readonly buffer Meshlets
 	Meshlet meshlets[];
 };
 
-in taskNV block{
-	uint meshletIndices[32];
+layout(binding = 2)readonly buffer Draws
+{
+	MeshDraw draws[];
+};
+
+layout(binding = 3)readonly buffer MeshletVertices
+{
+	uint meshletVertices[];
+};
+
+layout(binding = 4)readonly buffer MeshletTriangles
+{
+	uint8_t meshletTriangles[];
+};
+
+#ifdef MESH_NV
+in taskNV block
+{
+	uint drawId;
+	uint meshletIndices[kMeshletGroupSize];
+} payload;
+#else
+struct TaskPayload
+{
+	uint drawId;
+	uint meshletIndices[kMeshletGroupSize];
+};
+
+taskPayloadSharedEXT TaskPayload payload;
+#endif
+
+layout(push_constant) uniform block
+{
+	Globals globals;
 };
 
 layout(location = 0)out vec4 color[];
 
+// clip space positions for the triangle tests, and the number of triangles that pass them; EXT keeps those triangles here as well,
+// packed as a | b << 8 | c << 16, because its output counts have to be set before the indices can be written
+shared vec4 vertexClip[MESHLET_MAX_VERTICES];
+shared uint primitiveIndices[MESHLET_MAX_TRIANGLES];
+shared uint primitiveCount;
+
 uint hash(uint a)
 {
 	a = (a + 0x7ed55d16) + (a << 12);
@@ -41,43 +91,161 @@ uint hash(uint a)
 	return a;
 }
 
+// Backfacing and zero area triangles, triangles outside the frustum's side planes and triangles that cover no pixel center
+bool triangleCulled(vec4 ca, vec4 cb, vec4 cc, vec2 screen)
+{
+	// triangles that cross the camera plane do not project to a triangle, so only the ones in front of it are tested
+	if (ca.w <= 0 || cb.w <= 0 || cc.w <= 0)
+		return false;
+
+	vec2 pa = ca.xy / ca.w;
+	vec2 pb = cb.xy / cb.w;
+	vec2 pc = cc.xy / cc.w;
+
+	// the viewport flips Y, so counter-clockwise in the rasterizer is counter-clockwise here as well; zero area goes too
+	vec2 eb = pb - pa;
+	vec2 ec = pc - pa;
+
+	if (eb.x * ec.y - eb.y * ec.x <= 0)
+		return true;
+
+	vec2 bmin = min(pa, min(pb, pc));
+	vec2 bmax = max(pa, max(pb, pc));
+
+	if (bmin.x > 1 || bmax.x < -1 || bmin.y > 1 || bmax.y < -1)
+		return true;
+
+	// a triangle whose bounds stay between two pixel centers on either axis covers no sample; the margin absorbs subpixel snapping
+	vec2 smin = (bmin * 0.5 + 0.5) * screen;
+	vec2 smax = (bmax * 0.5 + 0.5) * screen;
+	float subpixel = 1.0 / 256.0;
+
+	return round(smin.x - subpixel) == round(smax.x) || round(smin.y) == round(smax.y + subpixel);
+}
+
+vec4 clipPosition(Vertex v, MeshDraw draw)
+{
+	vec3 position = decodePosition(v, vec4(draw.positionOffset, draw.positionScale));
+	vec3 world = transformPosition(position, draw);
+
+	return projectPosition((globals.view * vec4(world, 1.0)).xyz, globals.projection);
+}
+
+void writeVertex(uint i, Vertex v, vec4 clip, MeshDraw draw, uint mi)
+{
+	vec3 normal = rotateQuat(decodeNormal(v), draw.orientation);
+
+#ifdef MESH_NV
+	gl_MeshVerticesNV[i].gl_Position = clip;
+#else
+	gl_MeshVerticesEXT[i].gl_Position = clip;
+#endif
+
+	color[i] = vec4(normal * 0.5 + vec3(0.5), 1.0);
+#if DEBUG
+	uint mhash = hash(mi);
+	color[i] = vec4(vec3(float(mhash & 255), float((mhash >> 8) & 255), float((mhash >> 16) & 255)) / 255.0, 1.0);
+#endif
+}
+
 void main() {
-	uint mi = meshletIndices[gl_WorkGroupID.x];
+	uint mi = payload.meshletIndices[gl_WorkGroupID.x];
 	uint ti = gl_LocalInvocationID.x;
 
+	MeshDraw draw = draws[payload.drawId];
+
+	uint vertexOffset = meshlets[mi].vertexOffset;
+	uint triangleOffset = meshlets[mi].triangleOffset;
 	uint vertexCount = uint(meshlets[mi].vertexCount);
 	uint triangleCount = uint(meshlets[mi].triangleCount);
 	uint indexCount = triangleCount * 3;
 
-#if DEBUG
-	uint mhash = hash(mi);
-	vec3 hashColor = vec3(float(mhash & 255), float((mhash >> 8) & 255), float((mhash >> 16) & 255)) / 255.0;
+	bool cull = globals.triangleCulling != 0;
+
+#ifdef MESH_NV
+	for (uint i = ti; i < vertexCount; i += gl_WorkGroupSize.x) {
+		Vertex v = vertices[meshletVertices[vertexOffset + i]];
+		vec4 clip = clipPosition(v, draw);
+
+		vertexClip[i] = clip;
+		writeVertex(i, v, clip, draw, mi);
+	}
+#else
+	// no output can be written before SetMeshOutputsEXT, so only the positions the triangle tests need are computed up front
+	if (cull) {
+		for (uint i = ti; i < vertexCount; i += gl_WorkGroupSize.x) {
+			vertexClip[i] = clipPosition(vertices[meshletVertices[vertexOffset + i]], draw);
+		}
+	}
 #endif
 
-	for (uint i = ti; i < vertexCount; i += 32) {
-		uint vi = meshlets[mi].vertices[i];
-		Vertex v = vertices[vi];
+	uint primitives = triangleCount;
 
-		vec3 position = vec3(v.vx, v.vy, v.vz);
-		vec3 normal = vec3(v.nx, v.ny, v.nz) / 127.0 - 1.0;
-		vec2 texcoord = vec2(v.tu, v.tv);
+	if (cull) {
+		if (ti == 0) {
+			primitiveCount = 0;
+		}
 
-		gl_MeshVerticesNV[i].gl_Position = vec4(position + vec3(0.0, 0.0, 0.5), 1.0);
+		memoryBarrierShared();
+		barrier();
 
-		float meshletColorR = float(mi % 255u);
-		float meshletColorG = float(mi % 127u);
-		float meshletColorB = float(mi % 63u);
-		color[i] = vec4(normal * 0.5 + vec3(0.5), 1.0);
-#if DEBUG
-		color[i] = vec4(hashColor, 1.0);
+		for (uint i = ti; i < triangleCount; i += gl_WorkGroupSize.x) {
+			uint a = uint(meshletTriangles[triangleOffset + i * 3 + 0]);
+			uint b = uint(meshletTriangles[triangleOffset + i * 3 + 1]);
+			uint c = uint(meshletTriangles[triangleOffset + i * 3 + 2]);
+
+			if (!triangleCulled(vertexClip[a], vertexClip[b], vertexClip[c], globals.screen)) {
+				uint index = atomicAdd(primitiveCount, 1);
+
+#ifdef MESH_NV
+				gl_PrimitiveIndicesNV[index * 3 + 0] = a;
+				gl_PrimitiveIndicesNV[index * 3 + 1] = b;
+				gl_PrimitiveIndicesNV[index * 3 + 2] = c;
+#else
+				primitiveIndices[index] = a | (b << 8) | (c << 16);
 #endif
+			}
+		}
+
+		memoryBarrierShared();
+		barrier();
+
+		primitives = primitiveCount;
 	}
 
-	for (uint i = ti; i < indexCount; i += 32) {
-		gl_PrimitiveIndicesNV[i] = uint(meshlets[mi].indices[i]);
+#ifdef MESH_NV
+	if (!cull) {
+		for (uint i = ti; i < indexCount; i += gl_WorkGroupSize.x) {
+			gl_PrimitiveIndicesNV[i] = uint(meshletTriangles[triangleOffset + i]);
+		}
 	}
 
 	if (ti == 0) {
-		gl_PrimitiveCountNV = uint(meshlets[mi].triangleCount);
+		gl_PrimitiveCountNV = primitives;
+	}
+#else
+	// culled triangles never reach the outputs, so the rasterizer only sees the ones that pass, same as with NV
+	SetMeshOutputsEXT(vertexCount, primitives);
+
+	for (uint i = ti; i < vertexCount; i += gl_WorkGroupSize.x) {
+		Vertex v = vertices[meshletVertices[vertexOffset + i]];
+
+		writeVertex(i, v, cull ? vertexClip[i] : clipPosition(v, draw), draw, mi);
+	}
+
+	for (uint i = ti; i < primitives; i += gl_WorkGroupSize.x) {
+		if (cull) {
+			uint triangle = primitiveIndices[i];
+
+			gl_PrimitiveTriangleIndicesEXT[i] = uvec3(triangle & 255, (triangle >> 8) & 255, triangle >> 16);
+		}
+		else {
+			uint a = uint(meshletTriangles[triangleOffset + i * 3 + 0]);
+			uint b = uint(meshletTriangles[triangleOffset + i * 3 + 1]);
+			uint c = uint(meshletTriangles[triangleOffset + i * 3 + 2]);
+
+			gl_PrimitiveTriangleIndicesEXT[i] = uvec3(a, b, c);
+		}
 	}
-}
\ No newline at end of file
+#endif
+}
@@ -2,47 +2,182 @@
 
 #extension GL_EXT_shader_16bit_storage : require
 #extension GL_EXT_shader_8bit_storage : require
+#ifdef MESH_NV
 #extension GL_NV_mesh_shader : require
+#else
+#extension GL_EXT_mesh_shader : require
+#endif
 #extension GL_EXT_shader_explicit_arithmetic_types : require
+#extension GL_ARB_shader_draw_parameters : require
+#ifdef TASK_SUBGROUPS
+#extension GL_KHR_shader_subgroup_ballot : require
+#endif
 
 #extension GL_GOOGLE_include_directive : require
 
 #include "mesh.h"
 
-layout(local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
+// up to kMeshletGroupSize lanes, chosen from the device's preferred task workgroup size and passed as constant 0; each lane covers every gl_WorkGroupSize.x-th meshlet of the group
+layout(local_size_x_id = 0) in;
 
-layout(binding = 1)readonly buffer Meshlets
+// TASK_SUBGROUPS builds the .subgroups.spv variants, which compact visible meshlets with subgroup ballots and need the workgroup to be a single subgroup;
+// the default build uses an atomic counter in shared memory and does not declare any subgroup capability, so it runs on devices without ballots
+
+layout(binding = 2)readonly buffer Draws
+{
+	MeshDraw draws[];
+};
+
+layout(binding = 5)readonly buffer TaskCommands
+{
+	MeshTaskCommand taskCommands[];
+};
+
+// a bit per meshlet that passed all tests in the second pass of the previous frame, per draw
+layout(binding = 6) buffer MeshletVisibility
+{
+	uint meshletVisibility[];
+};
+
+layout(binding = 7) uniform sampler2D depthPyramid;
+
+layout(binding = 8) readonly buffer MeshletSpheres
 {
-	Meshlet meshlets[];
+	vec4 meshletSpheres[];
 };
 
-out taskNV block{
-	uint meshletIndices[32];
+layout(binding = 9) readonly buffer MeshletCones
+{
+	uint meshletCones[];
 };
 
-bool coneCull(vec4 cone, vec3 view) {
-	return dot(cone.xyz, view) >= cone.w;
-}
+layout(binding = 10) readonly buffer GroupSpheres
+{
+	vec4 groupSpheres[];
+};
 
-shared uint meshletCount;
+layout(binding = 11) readonly buffer GroupCones
+{
+	uint groupCones[];
+};
+
+layout(push_constant) uniform block
+{
+	Globals globals;
+};
+
+#ifdef MESH_NV
+out taskNV block
+{
+	uint drawId;
+	uint meshletIndices[kMeshletGroupSize];
+} payload;
+#else
+struct TaskPayload
+{
+	uint drawId;
+	uint meshletIndices[kMeshletGroupSize];
+};
+
+taskPayloadSharedEXT TaskPayload payload;
+#endif
+
+shared uint sharedMeshletCount;
 
 void main() {
 	uint mgi = gl_WorkGroupID.x;
 	uint ti = gl_LocalInvocationID.x;
-	uint mi = mgi * 32 + ti;
 
-	meshletCount = 0;
+	// commands are compacted by drawcull.comp.glsl, so gl_DrawIDARB indexes them and the command names the draw
+	MeshTaskCommand command = taskCommands[gl_DrawIDARB];
+	MeshDraw draw = draws[command.drawId];
+
+#ifndef TASK_SUBGROUPS
+	if (ti == 0) {
+		sharedMeshletCount = 0;
+	}
 
 	memoryBarrierShared();
+	barrier();
+#endif
+
+	uint meshletCount = 0;
+
+	// every lane runs the same group test on the same data, which is uniform and cheaper than sharing one lane's result;
+	// meshlets of a rejected group skip their own tests and bounds
+	uint gi = command.groupOffset + mgi;
+	bool groupVisible = meshletVisible(groupSpheres[gi], groupCones[gi], draw, globals, depthPyramid);
+
+	// every lane runs the same number of iterations, which keeps the ballots in uniform control flow
+	for (uint gls = 0; gls < kMeshletGroupSize; gls += gl_WorkGroupSize.x) {
+		uint gli = gls + ti;
+
+		// the last group of a draw is usually partial since meshlets are not padded to multiples of 32
+		uint mli = mgi * kMeshletGroupSize + gli;
+		uint mi = command.meshletOffset + mli;
+		uint vi = draw.meshletVisibilityOffset + mli;
+		uint vbit = 1u << (vi & 31);
+
+		bool valid = gli < kMeshletGroupSize && mli < command.meshletCount;
+		bool visible = valid && groupVisible && meshletVisible(meshletSpheres[mi], meshletCones[mi], draw, globals, depthPyramid);
 
-	if (!coneCull(meshlets[mi].cone, vec3(0, 0, 1))) {
-		uint index = atomicAdd(meshletCount, 1);
-		meshletIndices[index] = mi;
+		// the first pass draws what was visible last frame; the second tests everything against the depth the first pass left behind
+		// and draws only what the first pass skipped, and what it finds visible is what the next frame's first pass draws
+		bool emit = visible;
+
+		if (globals.occlusion != 0) {
+			// lanes share visibility words, so the bits are updated atomically; each lane only reads its own bit
+			bool previous = valid && (meshletVisibility[vi >> 5] & vbit) != 0;
+
+			if (globals.late != 0) {
+				emit = visible && (command.drawVisibility == 0 || !previous);
+
+				if (valid) {
+					if (visible)
+						atomicOr(meshletVisibility[vi >> 5], vbit);
+					else
+						atomicAnd(meshletVisibility[vi >> 5], ~vbit);
+				}
+			}
+			else {
+				emit = visible && previous;
+			}
+		}
+
+#ifdef TASK_SUBGROUPS
+		// lanes below this one that emit come first, so meshlets keep their order and the count stays in a register
+		uvec4 ballot = subgroupBallot(emit);
+
+		if (emit) {
+			payload.meshletIndices[meshletCount + subgroupBallotExclusiveBitCount(ballot)] = mi;
+		}
+
+		meshletCount += subgroupBallotBitCount(ballot);
+#else
+		if (emit) {
+			uint index = atomicAdd(sharedMeshletCount, 1);
+			payload.meshletIndices[index] = mi;
+		}
+#endif
 	}
 
+	// the count is read by every lane for EmitMeshTasksEXT, which also has to be reached by all of them
+#ifndef TASK_SUBGROUPS
 	memoryBarrierShared();
+	barrier();
+
+	meshletCount = sharedMeshletCount;
+#endif
+
+	if (ti == 0) {
+		payload.drawId = command.drawId;
+	}
 
+#ifdef MESH_NV
 	if (ti == 0) {
 		gl_TaskCountNV = meshletCount;
 	}
+#else
+	EmitMeshTasksEXT(meshletCount, 1, 1);
+#endif
 }
\ No newline at end of file
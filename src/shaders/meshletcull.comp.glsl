@@ -0,0 +1,157 @@
+#version 450
+
+#extension GL_EXT_shader_16bit_storage : require
+#extension GL_EXT_shader_8bit_storage : require
+#extension GL_EXT_shader_explicit_arithmetic_types : require
+
+#extension GL_GOOGLE_include_directive : require
+
+#include "mesh.h"
+
+layout(local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 0) readonly buffer Meshlets
+{
+	Meshlet meshlets[];
+};
+
+layout(binding = 1) readonly buffer Draws
+{
+	MeshDraw draws[];
+};
+
+layout(binding = 2) readonly buffer MeshletVertices
+{
+	uint meshletVertices[];
+};
+
+layout(binding = 3) readonly buffer MeshletTriangles
+{
+	uint8_t meshletTriangles[];
+};
+
+layout(binding = 4) readonly buffer TaskCommands
+{
+	MeshTaskCommand taskCommands[];
+};
+
+// Written by drawcull.comp.glsl in the order of taskCommands; indexCount grows as meshlets are added
+layout(binding = 5) buffer CulledCommands
+{
+	DrawCommand culledCommands[];
+};
+
+// a bit per meshlet that passed all tests in the second pass of the previous frame, per draw
+layout(binding = 6) buffer MeshletVisibility
+{
+	uint meshletVisibility[];
+};
+
+layout(binding = 7) uniform sampler2D depthPyramid;
+
+layout(binding = 8) writeonly buffer CompactedIndices
+{
+	uint compactedIndices[];
+};
+
+layout(binding = 9) readonly buffer MeshletSpheres
+{
+	vec4 meshletSpheres[];
+};
+
+layout(binding = 10) readonly buffer MeshletCones
+{
+	uint meshletCones[];
+};
+
+layout(binding = 11) readonly buffer GroupSpheres
+{
+	vec4 groupSpheres[];
+};
+
+layout(binding = 12) readonly buffer GroupCones
+{
+	uint groupCones[];
+};
+
+layout(binding = 13) readonly buffer Counts
+{
+	CullCounts counts;
+};
+
+layout(push_constant) uniform block
+{
+	Globals globals;
+};
+
+void cullMeshlet(uint ci, MeshTaskCommand command, uint mgi)
+{
+	uint mli = mgi * kMeshletGroupSize + gl_LocalInvocationID.x;
+
+	if (mli >= command.meshletCount)
+		return;
+
+	uint mi = command.meshletOffset + mli;
+	uint gi = command.groupOffset + mgi;
+
+	MeshDraw draw = draws[command.drawId];
+	uint vi = draw.meshletVisibilityOffset + mli;
+	uint vbit = 1u << (vi & 31);
+
+	// same group test and two passes as meshlet.task.glsl
+	bool visible =
+		meshletVisible(groupSpheres[gi], groupCones[gi], draw, globals, depthPyramid) &&
+		meshletVisible(meshletSpheres[mi], meshletCones[mi], draw, globals, depthPyramid);
+
+	bool emit = visible;
+
+	if (globals.occlusion != 0) {
+		bool previous = (meshletVisibility[vi >> 5] & vbit) != 0;
+
+		if (globals.late != 0) {
+			emit = visible && (command.drawVisibility == 0 || !previous);
+
+			if (visible)
+				atomicOr(meshletVisibility[vi >> 5], vbit);
+			else
+				atomicAnd(meshletVisibility[vi >> 5], ~vbit);
+		}
+		else {
+			emit = visible && previous;
+		}
+	}
+
+	if (!emit)
+		return;
+
+	uint vertexOffset = meshlets[mi].vertexOffset;
+	uint triangleOffset = meshlets[mi].triangleOffset;
+	uint indexCount = uint(meshlets[mi].triangleCount) * 3;
+
+	uint indexOffset = culledCommands[ci].firstIndex + atomicAdd(culledCommands[ci].indexCount, indexCount);
+
+	for (uint i = 0; i < indexCount; ++i)
+		compactedIndices[indexOffset + i] = meshletVertices[vertexOffset + uint(meshletTriangles[triangleOffset + i])];
+}
+
+// The task shader's culling for the classic pipeline: one thread per meshlet, dispatched indirectly from CullCounts with a workgroup per group of meshlets
+// along X and the commands spread over rows along Y and layers of rows along Z, so that neither exceeds maxComputeWorkGroupCount
+// Visible meshlets append their triangles to their draw's command, in the LOD's range of the compacted index buffer
+void main()
+{
+	uint ci = gl_WorkGroupID.z * kCommandRowSize + gl_WorkGroupID.y;
+
+	// the last layer is usually partial
+	if (ci >= counts.commandCount)
+		return;
+
+	MeshTaskCommand command = taskCommands[ci];
+
+	// commands without room in the compacted index buffer are not drawn
+	if (culledCommands[ci].instanceCount == 0)
+		return;
+
+	// X is clamped to the device limit, so a workgroup covers every gl_NumWorkGroups.x-th group of meshlets of LODs with more groups
+	for (uint mgi = gl_WorkGroupID.x; mgi < command.taskCount; mgi += gl_NumWorkGroups.x)
+		cullMeshlet(ci, command, mgi);
+}
@@ -0,0 +1,93 @@
+// Vertex layouts shared by the application and the shaders
+// The layout is picked at compile time with VERTEX_FORMAT, which has to match between C++ and GLSL (see VertexFormat in stairs.vcxproj)
+
+#define VERTEX_FORMAT_HALF 0 // 16 bytes: half position, 8-bit normal, half texcoord
+#define VERTEX_FORMAT_COMPACT 1 // 8 bytes: half position, octahedral normal, no texcoord
+#define VERTEX_FORMAT_UNORM16 2 // 12 bytes: unorm16 position relative to the mesh bounds, octahedral normal, half texcoord
+#define VERTEX_FORMAT_FLOAT 3 // 32 bytes: full precision, for debugging quantization issues
+
+#ifndef VERTEX_FORMAT
+#define VERTEX_FORMAT VERTEX_FORMAT_HALF
+#endif
+
+// Every layout is spelled out once; C++ gets one struct per layout, GLSL gets the selected one as Vertex
+#define VERTEX_LAYOUT_HALF float16_t vx, vy, vz, vw; uint8_t nx, ny, nz, nw; float16_t tu, tv;
+#define VERTEX_LAYOUT_COMPACT float16_t vx, vy, vz; int8_t nu, nv;
+#define VERTEX_LAYOUT_UNORM16 uint16_t vx, vy, vz; int8_t nu, nv; float16_t tu, tv;
+#define VERTEX_LAYOUT_FLOAT float vx, vy, vz; float nx, ny, nz; float tu, tv;
+
+#ifdef __cplusplus
+
+typedef uint16_t float16_t; // halves are stored as raw bits on the CPU
+
+struct VertexHalf { VERTEX_LAYOUT_HALF };
+struct VertexCompact { VERTEX_LAYOUT_COMPACT };
+struct VertexUnorm16 { VERTEX_LAYOUT_UNORM16 };
+struct VertexFloat { VERTEX_LAYOUT_FLOAT };
+
+template <int Format> struct VertexLayout;
+template <> struct VertexLayout<VERTEX_FORMAT_HALF> { typedef VertexHalf Type; };
+template <> struct VertexLayout<VERTEX_FORMAT_COMPACT> { typedef VertexCompact Type; };
+template <> struct VertexLayout<VERTEX_FORMAT_UNORM16> { typedef VertexUnorm16 Type; };
+template <> struct VertexLayout<VERTEX_FORMAT_FLOAT> { typedef VertexFloat Type; };
+
+typedef VertexLayout<VERTEX_FORMAT>::Type Vertex;
+
+const char* const kVertexFormatNames[] = { "half", "compact", "unorm16", "float" };
+
+#else
+
+struct Vertex
+{
+#if VERTEX_FORMAT == VERTEX_FORMAT_HALF
+	VERTEX_LAYOUT_HALF
+#elif VERTEX_FORMAT == VERTEX_FORMAT_COMPACT
+	VERTEX_LAYOUT_COMPACT
+#elif VERTEX_FORMAT == VERTEX_FORMAT_UNORM16
+	VERTEX_LAYOUT_UNORM16
+#elif VERTEX_FORMAT == VERTEX_FORMAT_FLOAT
+	VERTEX_LAYOUT_FLOAT
+#else
+#error Unknown VERTEX_FORMAT
+#endif
+};
+
+// bounds.xyz is the offset and bounds.w the scale that unorm16 positions were quantized with
+vec3 decodePosition(Vertex v, vec4 bounds)
+{
+#if VERTEX_FORMAT == VERTEX_FORMAT_UNORM16
+	return bounds.xyz + vec3(v.vx, v.vy, v.vz) * bounds.w;
+#else
+	return vec3(v.vx, v.vy, v.vz);
+#endif
+}
+
+vec3 decodeNormal(Vertex v)
+{
+#if VERTEX_FORMAT == VERTEX_FORMAT_HALF
+	return vec3(v.nx, v.ny, v.nz) / 127.0 - 1.0;
+#elif VERTEX_FORMAT == VERTEX_FORMAT_FLOAT
+	return vec3(v.nx, v.ny, v.nz);
+#else
+	vec2 e = vec2(v.nu, v.nv) / 127.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+
+	// lower hemisphere is folded over the diagonals
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+
+	return normalize(n);
+#endif
+}
+
+vec2 decodeTexcoord(Vertex v)
+{
+#if VERTEX_FORMAT == VERTEX_FORMAT_COMPACT
+	return vec2(0.0);
+#else
+	return vec2(v.tu, v.tv);
+#endif
+}
+
+#endif
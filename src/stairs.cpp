@@ -1,24 +1,43 @@
 ﻿#include "common.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <GLFW/glfw3.h>
 #include <GLFW/glfw3native.h>
 
-#define FAST_OBJ_IMPLEMENTATION
-#include <fast_obj.h>
-#include <meshoptimizer.h>
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 
 #include <algorithm>
 #include "shaders.h"
+#include "mesh.h"
+#include "scene.h"
+#include "meshcache.h"
+#include "loader.h"
+#include "cull.h"
+#include "bench.h"
 
 
 bool rtxEnabled = false;
+bool lodEnabled = true;
+bool occlusionEnabled = true;
+bool cpuCullEnabled = false;
+bool triangleCullEnabled = true;
+bool taskSubgroupsEnabled = true;
+int taskBenchmarkFrames = 0;
+
+// frames that the task shader compaction benchmark alternates between the subgroup and the shared memory pipelines
+const int kTaskBenchmarkFrames = 256;
 
 VkInstance createInstance()
 {
-	// SHORTCUT: In real Vulkan applications you should probably check if 1.1 is available via vkEnumerateInstanceVersion
+	// SHORTCUT: In real Vulkan applications you should probably check if 1.2 is available via vkEnumerateInstanceVersion
+	// 1.2 brings SPIR-V 1.4, which VK_EXT_mesh_shader requires
 	VkApplicationInfo appInfo = { VK_STRUCTURE_TYPE_APPLICATION_INFO };
-	appInfo.apiVersion = VK_API_VERSION_1_1;
+	appInfo.apiVersion = VK_API_VERSION_1_2;
 
 	VkInstanceCreateInfo createInfo = { VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO };
 	createInfo.pApplicationInfo = &appInfo;
@@ -160,7 +179,8 @@ VkPhysicalDevice pickPhysicalDevice(VkPhysicalDevice* physicalDevices, uint32_t
 	return result;
 }
 
-VkDevice createDevice(VkInstance instance, VkPhysicalDevice physicalDevice, uint32_t familyIndex, bool rtxSupported)
+// rtxSupported enables VK_EXT_mesh_shader, or VK_NV_mesh_shader with meshShaderNV
+VkDevice createDevice(VkInstance instance, VkPhysicalDevice physicalDevice, uint32_t familyIndex, bool rtxSupported, bool meshShaderNV)
 {
 	float queuePriorities[] = { 1.0f };
 
@@ -178,20 +198,27 @@ VkDevice createDevice(VkInstance instance, VkPhysicalDevice physicalDevice, uint
 	};
 
 	if (rtxSupported) {
-		extensions.push_back(VK_NV_MESH_SHADER_EXTENSION_NAME);
+		extensions.push_back(meshShaderNV ? VK_NV_MESH_SHADER_EXTENSION_NAME : VK_EXT_MESH_SHADER_EXTENSION_NAME);
 	}
 
 	VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
 	features.features.vertexPipelineStoresAndAtomics = true;
+	features.features.multiDrawIndirect = true;
+	features.features.drawIndirectFirstInstance = true;
+	features.features.shaderInt16 = true;
 
 	VkPhysicalDevice16BitStorageFeatures features16bit = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES };
 	features16bit.uniformAndStorageBuffer16BitAccess = true;
 	features16bit.storageBuffer16BitAccess = true;
 
+	VkPhysicalDeviceVulkan11Features features11 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES };
+	features11.shaderDrawParameters = true;
+
 	VkPhysicalDeviceVulkan12Features features12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
 	features12.shaderInt8 = true;
 	features12.uniformAndStorageBuffer8BitAccess = true;
 	features12.shaderFloat16 = true;
+	features12.drawIndirectCount = true;
 
 	VkDeviceCreateInfo createInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
 	createInfo.queueCreateInfoCount = 1;
@@ -202,13 +229,19 @@ VkDevice createDevice(VkInstance instance, VkPhysicalDevice physicalDevice, uint
 
 	createInfo.pNext = &features;
 	features.pNext = &features16bit;
-	features16bit.pNext = &features12;
+	features16bit.pNext = &features11;
+	features11.pNext = &features12;
+
+	VkPhysicalDeviceMeshShaderFeaturesNV meshShaderFeaturesNV = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_NV };
+	meshShaderFeaturesNV.meshShader = true;
+	meshShaderFeaturesNV.taskShader = true;
+
+	VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
+	meshShaderFeatures.meshShader = true;
+	meshShaderFeatures.taskShader = true;
 
 	if (rtxSupported) {
-		VkPhysicalDeviceMeshShaderFeaturesNV meshShaderFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_NV };
-		meshShaderFeatures.meshShader = true;
-		meshShaderFeatures.taskShader = true;
-		features12.pNext = &meshShaderFeatures;
+		features12.pNext = meshShaderNV ? (void*)&meshShaderFeaturesNV : (void*)&meshShaderFeatures;
 	}
 
 	VkDevice device = 0;
@@ -306,24 +339,37 @@ VkCommandPool createCommandPool(VkDevice device, uint32_t familyIndex)
 	return commandPool;
 }
 
-VkRenderPass createRenderPass(VkDevice device, VkFormat format)
+// The first pass of a frame clears both attachments, the second one draws on top of it; both are compatible with the same pipelines and framebuffers
+VkRenderPass createRenderPass(VkDevice device, VkFormat colorFormat, VkFormat depthFormat, bool late)
 {
-	VkAttachmentDescription attachments[1] = {};
-	attachments[0].format = format;
+	VkAttachmentDescription attachments[2] = {};
+	attachments[0].format = colorFormat;
 	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
-	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[0].loadOp = late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
 	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 	attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+	// depth is stored for the depth pyramid and the second pass
+	attachments[1].format = depthFormat;
+	attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[1].loadOp = late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].initialLayout = late ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
 	VkAttachmentReference colorAttachments = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference depthAttachment = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
 
 	VkSubpassDescription subpass = {};
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &colorAttachments;
+	subpass.pDepthStencilAttachment = &depthAttachment;
 
 	VkRenderPassCreateInfo createInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
 	createInfo.attachmentCount = sizeof(attachments) / sizeof(attachments[0]);
@@ -337,12 +383,14 @@ VkRenderPass createRenderPass(VkDevice device, VkFormat format)
 	return renderPass;
 }
 
-VkFramebuffer createFramebuffer(VkDevice device, VkRenderPass renderPass, VkImageView imageView, uint32_t width, uint32_t height)
+VkFramebuffer createFramebuffer(VkDevice device, VkRenderPass renderPass, VkImageView colorView, VkImageView depthView, uint32_t width, uint32_t height)
 {
+	VkImageView attachments[] = { colorView, depthView };
+
 	VkFramebufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
 	createInfo.renderPass = renderPass;
-	createInfo.attachmentCount = 1;
-	createInfo.pAttachments = &imageView;
+	createInfo.attachmentCount = ARRAYSIZE(attachments);
+	createInfo.pAttachments = attachments;
 	createInfo.width = width;
 	createInfo.height = height;
 	createInfo.layers = 1;
@@ -353,14 +401,15 @@ VkFramebuffer createFramebuffer(VkDevice device, VkRenderPass renderPass, VkImag
 	return framebuffer;
 }
 
-VkImageView createImageView(VkDevice device, VkImage image, VkFormat format)
+VkImageView createImageView(VkDevice device, VkImage image, VkFormat format, uint32_t mipLevel = 0, uint32_t levelCount = 1)
 {
 	VkImageViewCreateInfo createInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
 	createInfo.image = image;
 	createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 	createInfo.format = format;
-	createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	createInfo.subresourceRange.levelCount = 1;
+	createInfo.subresourceRange.aspectMask = (format == VK_FORMAT_D32_SFLOAT) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+	createInfo.subresourceRange.baseMipLevel = mipLevel;
+	createInfo.subresourceRange.levelCount = levelCount;
 	createInfo.subresourceRange.layerCount = 1;
 
 	VkImageView view = 0;
@@ -369,7 +418,7 @@ VkImageView createImageView(VkDevice device, VkImage image, VkFormat format)
 	return view;
 }
 
-VkImageMemoryBarrier imageBarrier(VkImage image, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkImageLayout oldLayout, VkImageLayout newLayout)
+VkImageMemoryBarrier imageBarrier(VkImage image, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkImageLayout oldLayout, VkImageLayout newLayout, VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT)
 {
 	VkImageMemoryBarrier result = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
 
@@ -380,7 +429,7 @@ VkImageMemoryBarrier imageBarrier(VkImage image, VkAccessFlags srcAccessMask, Vk
 	result.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 	result.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 	result.image = image;
-	result.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	result.subresourceRange.aspectMask = aspectMask;
 	result.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
 	result.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
 
@@ -408,13 +457,12 @@ struct Swapchain
 
 	std::vector<VkImage> images;
 	std::vector<VkImageView> imageViews;
-	std::vector<VkFramebuffer> framebuffers;
 
 	uint32_t width, height;
 	uint32_t imageCount;
 };
 
-void createSwapchain(Swapchain& result, VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, uint32_t familyIndex, VkFormat format, VkRenderPass renderPass, VkSwapchainKHR oldSwapchain = 0)
+void createSwapchain(Swapchain& result, VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, uint32_t familyIndex, VkFormat format, VkSwapchainKHR oldSwapchain = 0)
 {
 	VkSurfaceCapabilitiesKHR surfaceCaps;
 	VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCaps));
@@ -438,18 +486,10 @@ void createSwapchain(Swapchain& result, VkPhysicalDevice physicalDevice, VkDevic
 		assert(imageViews[i]);
 	}
 
-	std::vector<VkFramebuffer> framebuffers(imageCount);
-	for (uint32_t i = 0; i < imageCount; ++i)
-	{
-		framebuffers[i] = createFramebuffer(device, renderPass, imageViews[i], width, height);
-		assert(framebuffers[i]);
-	}
-
 	result.swapchain = swapchain;
 
 	result.images = images;
 	result.imageViews = imageViews;
-	result.framebuffers = framebuffers;
 
 	result.width = width;
 	result.height = height;
@@ -458,16 +498,13 @@ void createSwapchain(Swapchain& result, VkPhysicalDevice physicalDevice, VkDevic
 
 void destroySwapchain(VkDevice device, const Swapchain& swapchain)
 {
-	for (uint32_t i = 0; i < swapchain.imageCount; ++i)
-		vkDestroyFramebuffer(device, swapchain.framebuffers[i], 0);
-
 	for (uint32_t i = 0; i < swapchain.imageCount; ++i)
 		vkDestroyImageView(device, swapchain.imageViews[i], 0);
 
 	vkDestroySwapchainKHR(device, swapchain.swapchain, 0);
 }
 
-void resizeSwapchainIfNecessary(Swapchain& result, VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, uint32_t familyIndex, VkFormat format, VkRenderPass renderPass)
+void resizeSwapchainIfNecessary(Swapchain& result, VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, uint32_t familyIndex, VkFormat format)
 {
 	VkSurfaceCapabilitiesKHR surfaceCaps;
 	VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCaps));
@@ -481,7 +518,7 @@ void resizeSwapchainIfNecessary(Swapchain& result, VkPhysicalDevice physicalDevi
 
 	Swapchain old = result;
 
-	createSwapchain(result, physicalDevice, device, surface, familyIndex, format, renderPass, old.swapchain);
+	createSwapchain(result, physicalDevice, device, surface, familyIndex, format, old.swapchain);
 
 	VK_CHECK(vkDeviceWaitIdle(device));
 
@@ -499,346 +536,387 @@ VkQueryPool createQueryPool(VkDevice device, uint32_t queryCount)
 	return queryPool;
 }
 
-struct Vertex {
-	uint16_t vx, vy, vz, vw;
-	uint8_t nx, ny, nz, nw;
-	uint16_t tu, tv;
-};
-
-struct alignas(16) Meshlet {
-	float cone[4];
-	uint32_t vertices[64];
-	uint8_t indices[126 * 3];
-	uint8_t triangleCount;
-	uint8_t vertexCount;
-};
-
-struct Mesh {
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
-	std::vector<Meshlet> meshlets;
+struct Buffer {
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	void* data;
+	size_t size;
 };
 
-bool loadMesh(Mesh& result, const char* path)
-{
-	fastObjMesh* obj = fast_obj_read(path);
-	if (!obj)
-	{
-		printf("Error loading %s: file not found\n", path);
-		return false;
+uint32_t selectMemoryType(const VkPhysicalDeviceMemoryProperties& memoryProperties, uint32_t memoryTypeBits, VkMemoryPropertyFlags flags) {
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+		if ((memoryTypeBits & (1 << i)) != 0 && (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags) {
+			return i;
+		}
 	}
 
-	size_t total_indices = 0;
+	assert(!"No compatible memory type found!");
+	return ~0u;
+}
 
-	for (unsigned int i = 0; i < obj->face_count; ++i)
-		total_indices += 3 * (obj->face_vertices[i] - 2);
+void createBuffer(Buffer& result, VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, size_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryFlags)
+{
+	result.size = size;
+	VkBufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	createInfo.size = size;
+	createInfo.usage = usage;
+	VK_CHECK(vkCreateBuffer(device, &createInfo, 0, &result.buffer));
 
-	std::vector<Vertex> vertices(total_indices);
+	VkMemoryRequirements memReqs;
+	vkGetBufferMemoryRequirements(device, result.buffer, &memReqs);
 
-	size_t vertex_offset = 0;
-	size_t index_offset = 0;
+	uint32_t memoryType = selectMemoryType(memoryProperties, memReqs.memoryTypeBits, memoryFlags);
+	assert(memoryType != ~0u);
 
-	for (unsigned int i = 0; i < obj->face_count; ++i)
-	{
-		for (unsigned int j = 0; j < obj->face_vertices[i]; ++j)
-		{
-			fastObjIndex gi = obj->indices[index_offset + j];
-
-			float nx = obj->normals[gi.n * 3 + 0];
-			float ny = obj->normals[gi.n * 3 + 1];
-			float nz = obj->normals[gi.n * 3 + 2];
-
-			Vertex v =
-			{
-				meshopt_quantizeHalf(obj->positions[gi.p * 3 + 0]),
-				meshopt_quantizeHalf(obj->positions[gi.p * 3 + 1]),
-				meshopt_quantizeHalf(obj->positions[gi.p * 3 + 2]),
-				meshopt_quantizeHalf(0.0f),
-				uint8_t(nx * 127.0f + 127.0f),
-				uint8_t(ny * 127.0f + 127.0f),
-				uint8_t(nz * 127.0f + 127.0f),
-				uint8_t(0),
-				meshopt_quantizeHalf(obj->texcoords[gi.t * 2 + 0]),
-				meshopt_quantizeHalf(obj->texcoords[gi.t * 2 + 1]),
-			};
+	VkMemoryAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	allocInfo.allocationSize = memReqs.size;
+	allocInfo.memoryTypeIndex = memoryType;
 
-			// triangulate polygon on the fly; offset-3 is always the first polygon vertex
-			if (j >= 3)
-			{
-				vertices[vertex_offset + 0] = vertices[vertex_offset - 3];
-				vertices[vertex_offset + 1] = vertices[vertex_offset - 1];
-				vertex_offset += 2;
-			}
+	result.memory = 0;
+	VK_CHECK(vkAllocateMemory(device, &allocInfo, 0, &result.memory));
 
-			vertices[vertex_offset] = v;
-			vertex_offset++;
-		}
+	VK_CHECK(vkBindBufferMemory(device, result.buffer, result.memory, 0));
 
-		index_offset += obj->face_vertices[i];
+	if (memoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		VK_CHECK(vkMapMemory(device, result.memory, 0, size, 0, &result.data));
 	}
-
-	fast_obj_destroy(obj);
-
-	std::vector<unsigned int> remap(total_indices);
-
-	size_t total_vertices = meshopt_generateVertexRemap(&remap[0], NULL, total_indices, &vertices[0], total_indices, sizeof(Vertex));
-
-	result.indices.resize(total_indices);
-	meshopt_remapIndexBuffer(&result.indices[0], NULL, total_indices, &remap[0]);
-
-	result.vertices.resize(total_vertices);
-	meshopt_remapVertexBuffer(&result.vertices[0], &vertices[0], total_indices, sizeof(Vertex), &remap[0]);
-
-	meshopt_optimizeVertexCache(result.indices.data(), result.indices.data(), total_indices, total_vertices);
-	meshopt_optimizeVertexFetch(result.vertices.data(), result.indices.data(), total_indices, result.vertices.data(), total_vertices, sizeof(Vertex));
-
-	return true;
 }
 
-void buildMeshlets(Mesh& mesh)
+void destroyBuffer(Buffer& result, VkDevice device)
 {
-	Meshlet meshlet = {};
-
-	std::vector<uint8_t> meshletVertices(mesh.vertices.size(), 0xff);
-
-	for (size_t i = 0; i < mesh.indices.size(); i += 3)
-	{
-		unsigned int a = mesh.indices[i + 0];
-		unsigned int b = mesh.indices[i + 1];
-		unsigned int c = mesh.indices[i + 2];
+	vkFreeMemory(device, result.memory, 0);
+	vkDestroyBuffer(device, result.buffer, 0);
+}
 
-		uint8_t& av = meshletVertices[a];
-		uint8_t& bv = meshletVertices[b];
-		uint8_t& cv = meshletVertices[c];
+struct Image {
+	VkImage image;
+	VkImageView imageView; // all mip levels
+	VkDeviceMemory memory;
+};
 
-		if (meshlet.vertexCount + (av == 0xff) + (bv == 0xff) + (cv == 0xff) > 64 || meshlet.triangleCount >= 126)
-		{
-			mesh.meshlets.push_back(meshlet);
+void createImage(Image& result, VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageUsageFlags usage)
+{
+	VkImageCreateInfo createInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	createInfo.imageType = VK_IMAGE_TYPE_2D;
+	createInfo.format = format;
+	createInfo.extent = { width, height, 1 };
+	createInfo.mipLevels = mipLevels;
+	createInfo.arrayLayers = 1;
+	createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	createInfo.usage = usage;
+	createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VK_CHECK(vkCreateImage(device, &createInfo, 0, &result.image));
 
-			for (size_t j = 0; j < meshlet.vertexCount; ++j)
-				meshletVertices[meshlet.vertices[j]] = 0xff;
+	VkMemoryRequirements memReqs;
+	vkGetImageMemoryRequirements(device, result.image, &memReqs);
 
-			meshlet = {};
-		}
+	uint32_t memoryType = selectMemoryType(memoryProperties, memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	assert(memoryType != ~0u);
 
-		if (av == 0xff)
-		{
-			av = meshlet.vertexCount;
-			meshlet.vertices[meshlet.vertexCount++] = a;
-		}
+	VkMemoryAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	allocInfo.allocationSize = memReqs.size;
+	allocInfo.memoryTypeIndex = memoryType;
 
-		if (bv == 0xff)
-		{
-			bv = meshlet.vertexCount;
-			meshlet.vertices[meshlet.vertexCount++] = b;
-		}
+	result.memory = 0;
+	VK_CHECK(vkAllocateMemory(device, &allocInfo, 0, &result.memory));
 
-		if (cv == 0xff)
-		{
-			cv = meshlet.vertexCount;
-			meshlet.vertices[meshlet.vertexCount++] = c;
-		}
+	VK_CHECK(vkBindImageMemory(device, result.image, result.memory, 0));
 
-		meshlet.indices[meshlet.triangleCount * 3 + 0] = av;
-		meshlet.indices[meshlet.triangleCount * 3 + 1] = bv;
-		meshlet.indices[meshlet.triangleCount * 3 + 2] = cv;
-		meshlet.triangleCount++;
-	}
+	result.imageView = createImageView(device, result.image, format, 0, mipLevels);
+}
 
-	if (meshlet.triangleCount)
-		mesh.meshlets.push_back(meshlet);
+void destroyImage(Image& image, VkDevice device)
+{
+	vkDestroyImageView(device, image.imageView, 0);
+	vkDestroyImage(device, image.image, 0);
+	vkFreeMemory(device, image.memory, 0);
+}
 
-	while(mesh.meshlets.size() % 32){
-		mesh.meshlets.push_back(Meshlet());
-	}
+// The culling and reduction shaders only use texelFetch, which ignores filtering, but sampled image descriptors still need a sampler
+VkSampler createSampler(VkDevice device)
+{
+	VkSamplerCreateInfo createInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	createInfo.magFilter = VK_FILTER_NEAREST;
+	createInfo.minFilter = VK_FILTER_NEAREST;
+	createInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	createInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	createInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	createInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	createInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	VkSampler sampler = 0;
+	VK_CHECK(vkCreateSampler(device, &createInfo, 0, &sampler));
+
+	return sampler;
 }
 
-float halfToFloat(uint16_t v) {
-	uint16_t sign = v >> 15;
-	uint16_t exp = (v >> 10) & 31;
-	uint16_t mant = v & 1023;
+// Largest power of two below v, so that every level of the depth pyramid, including the first, halves the one before
+uint32_t previousPow2(uint32_t v)
+{
+	uint32_t result = 1;
 
-	assert(exp != 31);
+	while (result * 2 < v)
+		result *= 2;
 
-	if (exp == 0) {
-		assert(mant == 0);
-		return 0.f;
-	}
-	else {
-		return (sign ? -1.f : 1.f) * ldexpf(float(mant + 1024) / 1024.f, exp - 15);
-	}
+	return result;
 }
 
-void buildMeshletCones(Mesh& mesh) {
-	for (Meshlet& meshlet : mesh.meshlets) {
-		float normals[126][3];
+uint32_t getImageMipLevels(uint32_t width, uint32_t height)
+{
+	uint32_t result = 1;
 
-		for (unsigned int i = 0; i < meshlet.triangleCount; ++i) {
-			unsigned int a = meshlet.indices[i * 3 + 0];
-			unsigned int b = meshlet.indices[i * 3 + 1];
-			unsigned int c = meshlet.indices[i * 3 + 2];
+	while (width > 1 || height > 1) {
+		result++;
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
 
-			const Vertex& va = mesh.vertices[meshlet.vertices[a]];
-			const Vertex& vb = mesh.vertices[meshlet.vertices[b]];
-			const Vertex& vc = mesh.vertices[meshlet.vertices[c]];
+	return result;
+}
 
-			float p0[3] = { halfToFloat(va.vx), halfToFloat(va.vy) , halfToFloat(va.vz) };
-			float p1[3] = { halfToFloat(vb.vx), halfToFloat(vb.vy) , halfToFloat(vb.vz) };
-			float p2[3] = { halfToFloat(vc.vx), halfToFloat(vc.vy) , halfToFloat(vc.vz) };
+void beginTransfer(VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer)
+{
+	VK_CHECK(vkResetCommandPool(device, commandPool, 0));
 
-			float p10[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
-			float p20[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-			float normalx = p10[1] * p20[2] - p10[2] * p20[1];
-			float normaly = p10[2] * p20[0] - p10[0] * p20[2];
-			float normalz = p10[0] * p20[1] - p10[1] * p20[0];
+	VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+}
 
-			float area = sqrtf(normalx * normalx + normaly * normaly + normalz * normalz);
-			float invarea = area == 0.f ? 0.f : 1 / area;
+void endTransfer(VkDevice device, VkCommandBuffer commandBuffer, VkQueue queue, const Buffer& buffer)
+{
+	VkBufferMemoryBarrier copyBarrier = bufferBarrier(buffer.buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
 
-			normals[i][0] = normalx * invarea;
-			normals[i][1] = normaly * invarea;
-			normals[i][2] = normalz * invarea;
-		}
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 1, &copyBarrier, 0, 0);
 
-		float avgnormals[3] = {};
+	VK_CHECK(vkEndCommandBuffer(commandBuffer));
 
-		for (unsigned int i = 0; i < meshlet.triangleCount; ++i) {
-			avgnormals[0] += normals[i][0];
-			avgnormals[1] += normals[i][1];
-			avgnormals[2] += normals[i][2];
-		}
+	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
 
-		float avglength = sqrtf(avgnormals[0] * avgnormals[0] + avgnormals[1] * avgnormals[1] + avgnormals[2] * avgnormals[2]);
+	VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 
-		if (avglength == 0.f) {
-			avgnormals[0] = 1.f;
-			avgnormals[1] = 1.f;
-			avgnormals[2] = 1.f;
-		}
-		else {
-			avgnormals[0] /= avglength;
-			avgnormals[1] /= avglength;
-			avgnormals[2] /= avglength;
-		}
+	VK_CHECK(vkDeviceWaitIdle(device));
+}
 
-		float mindp = 1.f;
+void uploadBuffer(VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, const Buffer& buffer, const Buffer& scratch, const void* data, size_t size, size_t offset = 0)
+{
+	assert(scratch.data);
+	assert(offset + size <= buffer.size);
 
-		for (unsigned int i = 0; i < meshlet.triangleCount; ++i) {
-			float dp = normals[i][0] * avgnormals[0] + normals[i][1] * avgnormals[1] + normals[i][2] * avgnormals[2];
+	// data that does not fit into the scratch buffer goes through it in several pieces
+	for (size_t piece = 0; piece < size; piece += scratch.size) {
+		size_t pieceSize = std::min(scratch.size, size - piece);
+		memcpy(scratch.data, static_cast<const char*>(data) + piece, pieceSize);
 
-			mindp = std::min(mindp, dp);
-		}
+		beginTransfer(device, commandPool, commandBuffer);
 
-		float conew = mindp <= 0.f ? 1 : sqrtf(1 - mindp * mindp);
+		VkBufferCopy region = { 0, VkDeviceSize(offset + piece), VkDeviceSize(pieceSize) };
+		vkCmdCopyBuffer(commandBuffer, scratch.buffer, buffer.buffer, 1, &region);
 
-		meshlet.cone[0] = avgnormals[0];
-		meshlet.cone[1] = avgnormals[1];
-		meshlet.cone[2] = avgnormals[2];
-		meshlet.cone[3] = conew;
+		endTransfer(device, commandBuffer, queue, buffer);
 	}
 }
-	
-struct Buffer {
-	VkBuffer buffer;
-	VkDeviceMemory memory;
-	void* data;
-	size_t size;
-};
 
-uint32_t selectMemoryType(const VkPhysicalDeviceMemoryProperties& memoryProperties, uint32_t memoryTypeBits, VkMemoryPropertyFlags flags) {
-	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
-		if ((memoryTypeBits & (1 << i)) != 0 && (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags) {
-			return i;
-		}
-	}
+void fillBuffer(VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, const Buffer& buffer, uint32_t value, size_t size, size_t offset = 0)
+{
+	assert(offset + size <= buffer.size);
 
-	assert(!"No compatible memory type found!");
-	return ~0u;
+	beginTransfer(device, commandPool, commandBuffer);
+
+	vkCmdFillBuffer(commandBuffer, buffer.buffer, offset, size, value);
+
+	endTransfer(device, commandBuffer, queue, buffer);
 }
 
-void createBuffer(Buffer& result, VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, size_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryFlags)
+// Makes room for at least size bytes in a device-local buffer while keeping its contents; capacity at least doubles so that appending stays linear
+// usage needs TRANSFER_SRC since the old contents are copied on the GPU
+void growBuffer(Buffer& buffer, VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, size_t size, VkBufferUsageFlags usage)
 {
-	result.size = size;
-	VkBufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-	createInfo.size = size;
-	createInfo.usage = usage;
-	VK_CHECK(vkCreateBuffer(device, &createInfo, 0, &result.buffer));
+	if (size <= buffer.size)
+		return;
 
-	VkMemoryRequirements memReqs;
-	vkGetBufferMemoryRequirements(device, result.buffer, &memReqs);
+	Buffer result = {};
+	createBuffer(result, device, memoryProperties, std::max(size, buffer.size * 2), usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-	uint32_t memoryType = selectMemoryType(memoryProperties, memReqs.memoryTypeBits, memoryFlags);
-	assert(memoryType != ~0u);
-
-	VkMemoryAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-	allocInfo.allocationSize = memReqs.size;
-	allocInfo.memoryTypeIndex = memoryType;
+	if (buffer.buffer) {
+		beginTransfer(device, commandPool, commandBuffer);
 
-	result.memory = 0;
-	VK_CHECK(vkAllocateMemory(device, &allocInfo, 0, &result.memory));
+		VkBufferCopy region = { 0, 0, VkDeviceSize(buffer.size) };
+		vkCmdCopyBuffer(commandBuffer, buffer.buffer, result.buffer, 1, &region);
 
-	VK_CHECK(vkBindBufferMemory(device, result.buffer, result.memory, 0));
+		endTransfer(device, commandBuffer, queue, result);
 
-	if (memoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
-	{
-		VK_CHECK(vkMapMemory(device, result.memory, 0, size, 0, &result.data));
+		destroyBuffer(buffer, device);
 	}
+
+	buffer = result;
 }
 
-void uploadBuffer(VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer, VkQueue queue, const Buffer& buffer, const Buffer& scratch, const void* data, size_t size)
+size_t getPeakMemoryUsage()
 {
-	assert(scratch.data);
-	assert(scratch.size >= size);
-	memcpy(scratch.data, data, size);
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = { sizeof(counters) };
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return size_t(usage.ru_maxrss) * 1024;
+#endif
+}
 
-	VK_CHECK(vkResetCommandPool(device, commandPool, 0));
+// Push constants of every pipeline; mirrors Globals in shaders/mesh.h
+struct Globals {
+	mat4 view;
+	float projection[4]; // P00, P11, znear, unused
+	float frustum[4]; // see sphereInFrustum in shaders/mesh.h
+	uint32_t late; // second pass of occlusion culling
+	uint32_t occlusion;
+	float screen[2];
+	uint32_t triangleCulling;
+	float lodThreshold;
+};
 
-	VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+// Written by drawcull.comp; mirrors CullCounts in shaders/mesh.h
+struct CullCounts {
+	uint32_t commandCount;
+	uint32_t maxTaskCount;
+	uint32_t commandRows;
+	uint32_t commandLayers;
 
-	VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+	uint32_t compactedIndexCount;
+	uint32_t compactedIndexCapacity;
 
-	VkBufferCopy region = { 0,0,VkDeviceSize(size) };
-	vkCmdCopyBuffer(commandBuffer, scratch.buffer, buffer.buffer, 1, &region);
+	uint32_t drawCount;
+	uint32_t triangleCount;
+	uint32_t meshletCount;
 
-	VkBufferMemoryBarrier copyBarrier = bufferBarrier(buffer.buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+	uint32_t droppedCount;
+};
 
-	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 1, &copyBarrier, 0, 0);
+struct Camera {
+	vec3 position;
+	float yaw; // around +Y, 0 looks down -Z
+	float pitch; // around the camera's +X, positive looks up
+};
 
-	VK_CHECK(vkEndCommandBuffer(commandBuffer));
+quat getOrientation(const Camera& camera)
+{
+	return axisAngle({ 0, 1, 0 }, camera.yaw) * axisAngle({ 1, 0, 0 }, camera.pitch);
+}
 
-	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+// WASD moves in the view plane, Q/E move down/up, arrow keys turn; shift moves faster
+void updateCamera(Camera& camera, GLFWwindow* window, float deltaTime)
+{
+	const float kTurnSpeed = 1.5f; // radians per second
+	float moveSpeed = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS ? 10.f : 2.f;
 
-	VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+	camera.yaw += kTurnSpeed * deltaTime * float((glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) - (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS));
+	camera.pitch += kTurnSpeed * deltaTime * float((glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) - (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS));
+	camera.pitch = std::max(-1.5f, std::min(1.5f, camera.pitch));
 
-	VK_CHECK(vkDeviceWaitIdle(device));
-}
+	quat orientation = getOrientation(camera);
 
-void destroyBuffer(Buffer& result, VkDevice device)
-{
-	vkFreeMemory(device, result.memory, 0);
-	vkDestroyBuffer(device, result.buffer, 0);
+	vec3 move = {
+		float((glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) - (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)),
+		float((glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) - (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)),
+		float((glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) - (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)),
+	};
+
+	camera.position = camera.position + rotate(move, orientation) * (moveSpeed * deltaTime);
 }
 
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
 	if (key == GLFW_KEY_R && action == GLFW_PRESS) {
 		rtxEnabled = !rtxEnabled;
 	}
+	if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+		lodEnabled = !lodEnabled;
+	}
+	if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+		occlusionEnabled = !occlusionEnabled;
+	}
+	if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+		cpuCullEnabled = !cpuCullEnabled;
+	}
+	if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+		triangleCullEnabled = !triangleCullEnabled;
+	}
+	if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+		taskSubgroupsEnabled = !taskSubgroupsEnabled;
+	}
+	if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+		taskBenchmarkFrames = kTaskBenchmarkFrames;
+	}
 }
 
 int main(int argc, const char** argv)
 {
 	if (argc < 2) {
-		printf("Usage: %s [mesh]\n", argv[0]);
+		printf("Usage: %s [-lowmem] [-compress] [-validate] [-greedy] [-instances N] [mesh...]\n", argv[0]);
+		printf("       %s -bench [mesh]\n", argv[0]);
+		printf("Meshes can be .obj, .gltf or .glb (including EXT_meshopt_compression)\n");
+		printf("-compress writes mesh caches with the meshopt vertex/index codecs\n");
+		printf("-validate hashes mesh sources before using their caches even when size and write time match\n");
+		printf("-greedy builds meshlets in index order instead of with meshopt_buildMeshlets\n");
+		printf("-instances draws every mesh N times on a grid\n");
+		printf("Controls: WASD/QE move, arrow keys turn, shift moves faster, R toggles mesh shaders, L toggles LOD, O toggles occlusion culling, C toggles CPU culling, T toggles triangle culling in the mesh shader, G toggles subgroup compaction in the task shader, B compares it with the shared memory fallback\n");
 		return 1;
 	}
 
 	int rc = glfwInit();
 	assert(rc);
 
+	if (strcmp(argv[1], "-bench") == 0) {
+		if (argc < 3) {
+			printf("Usage: %s -bench [mesh]\n", argv[0]);
+			return 1;
+		}
+
+		runBenchmarks(argv[2]);
+		return 0;
+	}
+
+	std::vector<const char*> meshPaths;
+	bool lowMemory = false;
+	bool compressCache = false;
+	bool validateCache = false;
+	bool greedyMeshlets = false;
+	uint32_t instanceCount = 1;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-lowmem") == 0)
+			lowMemory = true;
+		else if (strcmp(argv[i], "-compress") == 0)
+			compressCache = true;
+		else if (strcmp(argv[i], "-validate") == 0)
+			validateCache = true;
+		else if (strcmp(argv[i], "-greedy") == 0)
+			greedyMeshlets = true;
+		else if (strcmp(argv[i], "-instances") == 0) {
+			int count = (i + 1 < argc) ? atoi(argv[++i]) : 0;
+
+			if (count <= 0) {
+				printf("Error: -instances needs a positive count\n");
+				return 1;
+			}
+
+			instanceCount = uint32_t(count);
+		}
+		else
+			meshPaths.push_back(argv[i]);
+	}
+
+	if (meshPaths.empty()) {
+		printf("Usage: %s [-lowmem] [-compress] [-validate] [-greedy] [-instances N] [mesh...]\n", argv[0]);
+		return 1;
+	}
+
 	VK_CHECK(volkInitialize());
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -865,32 +943,118 @@ int main(int argc, const char** argv)
 	std::vector<VkExtensionProperties> extensions(extensionCount);
 	VK_CHECK(vkEnumerateDeviceExtensionProperties(physicalDevice, 0, &extensionCount, extensions.data()));
 
-	bool rtxSupported = false;
+	bool meshShaderEXTSupported = false;
+	bool meshShaderNVSupported = false;
 	for (auto& ext : extensions) {
-		if (strcmp(ext.extensionName, "VK_NV_mesh_shader") == 0) {
-			rtxSupported = true;
-			break;
-		}
+		if (strcmp(ext.extensionName, VK_EXT_MESH_SHADER_EXTENSION_NAME) == 0)
+			meshShaderEXTSupported = true;
+		if (strcmp(ext.extensionName, VK_NV_MESH_SHADER_EXTENSION_NAME) == 0)
+			meshShaderNVSupported = true;
 	}
-	rtxEnabled = rtxSupported;
 
 	VkPhysicalDeviceProperties props;
 	vkGetPhysicalDeviceProperties(physicalDevice, &props);
 	assert(props.limits.timestampComputeAndGraphics);
+
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	assert(supportedFeatures.multiDrawIndirect);
+	assert(supportedFeatures.drawIndirectFirstInstance);
+	assert(supportedFeatures.shaderInt16);
+
+	// the vertex shader reads the draw index through gl_BaseInstanceARB
+	VkPhysicalDeviceVulkan11Features supportedFeatures11 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES };
+	VkPhysicalDeviceFeatures2 supportedFeatures2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	supportedFeatures2.pNext = &supportedFeatures11;
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
+	assert(supportedFeatures11.shaderDrawParameters);
 	
-	//VkPhysicalDeviceMeshShaderPropertiesEXT meshShaderProps;
-	//if (rtxSupported) {
-	//	meshShaderProps = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_EXT };
-	//	VkPhysicalDeviceProperties2 props2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
-	//	props2.pNext = &meshShaderProps;
-	//	vkGetPhysicalDeviceProperties2(physicalDevice, &props2);
-	//	assert(meshShaderProps.maxTaskSharedMemorySize > 16);
-	//}
+	// EXT may only expose mesh shaders without task shaders, which the mesh path needs
+	if (meshShaderEXTSupported) {
+		VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
+		VkPhysicalDeviceFeatures2 features2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+		features2.pNext = &meshShaderFeatures;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+		meshShaderEXTSupported = meshShaderFeatures.meshShader && meshShaderFeatures.taskShader;
+	}
+
+	bool meshShaderNV = !meshShaderEXTSupported && meshShaderNVSupported;
+	bool rtxSupported = meshShaderEXTSupported || meshShaderNVSupported;
+
+	// a task workgroup covers kMeshletGroupSize meshlets, so that is fixed; the lane counts follow what the device prefers, meshlets follow
+	// its output limits, and the mesh path is off when it cannot hold a task payload or even a small meshlet
+	uint32_t taskWorkGroupSize = kMeshletGroupSize;
+	uint32_t meshWorkGroupSize = 32;
+	const uint32_t kTaskPayloadSize = (1 + kMeshletGroupSize) * sizeof(uint32_t);
+	uint32_t maxMeshOutputVertices = 0, maxMeshOutputPrimitives = 0;
+
+	if (meshShaderNV) {
+		VkPhysicalDeviceMeshShaderPropertiesNV meshShaderProps = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_NV };
+		VkPhysicalDeviceProperties2 props2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+		props2.pNext = &meshShaderProps;
+		vkGetPhysicalDeviceProperties2(physicalDevice, &props2);
+
+		taskWorkGroupSize = std::min(taskWorkGroupSize, meshShaderProps.maxTaskWorkGroupInvocations);
+		meshWorkGroupSize = std::min(meshWorkGroupSize, meshShaderProps.maxMeshWorkGroupInvocations);
+
+		maxMeshOutputVertices = meshShaderProps.maxMeshOutputVertices;
+		maxMeshOutputPrimitives = meshShaderProps.maxMeshOutputPrimitives;
+
+		rtxSupported = meshShaderProps.maxTaskOutputCount >= kMeshletGroupSize;
+	}
+	else if (rtxSupported) {
+		VkPhysicalDeviceMeshShaderPropertiesEXT meshShaderProps = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_EXT };
+		VkPhysicalDeviceProperties2 props2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+		props2.pNext = &meshShaderProps;
+		vkGetPhysicalDeviceProperties2(physicalDevice, &props2);
+
+		taskWorkGroupSize = std::min({ taskWorkGroupSize, meshShaderProps.maxPreferredTaskWorkGroupInvocations, meshShaderProps.maxTaskWorkGroupSize[0] });
+		// lanes past the vertex count of a meshlet would only help with triangles, which are few enough to loop over
+		meshWorkGroupSize = std::min({ 64u, meshShaderProps.maxPreferredMeshWorkGroupInvocations, meshShaderProps.maxMeshWorkGroupSize[0] });
+
+		maxMeshOutputVertices = meshShaderProps.maxMeshOutputVertices;
+		maxMeshOutputPrimitives = meshShaderProps.maxMeshOutputPrimitives;
+
+		rtxSupported = meshShaderProps.maxTaskPayloadSize >= kTaskPayloadSize && meshShaderProps.maxMeshWorkGroupTotalCount[0] >= kMeshletGroupSize;
+	}
+
+	// the mesh shader outputs a whole meshlet and GLSL only takes literals for its output limits, so the .small.spv variants are built with
+	// MESHLET_MAX_VERTICES 32 and MESHLET_MAX_TRIANGLES 64 for devices that cannot output the largest meshlets; the cache keeps the limits
+	const MeshletLimits kSmallMeshletLimits = { 32, 64 };
+	MeshletLimits meshletLimits;
+	bool smallMeshlets = false;
+
+	if (rtxSupported && (maxMeshOutputVertices < meshletLimits.maxVertices || maxMeshOutputPrimitives < meshletLimits.maxTriangles)) {
+		rtxSupported = maxMeshOutputVertices >= kSmallMeshletLimits.maxVertices && maxMeshOutputPrimitives >= kSmallMeshletLimits.maxTriangles;
+		smallMeshlets = rtxSupported;
+
+		if (smallMeshlets)
+			meshletLimits = kSmallMeshletLimits;
+	}
+
+	// the subgroup variant of the task shader needs ballots in task shaders and a workgroup that is a single subgroup; without SPIR-V 1.6 or
+	// VK_EXT_subgroup_size_control the subgroup size of a task shader is the reported one
+	VkPhysicalDeviceSubgroupProperties subgroupProps = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES };
+	VkPhysicalDeviceProperties2 subgroupProps2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+	subgroupProps2.pNext = &subgroupProps;
+	vkGetPhysicalDeviceProperties2(physicalDevice, &subgroupProps2);
+
+	bool taskSubgroupsSupported = rtxSupported && (subgroupProps.supportedStages & VK_SHADER_STAGE_TASK_BIT_EXT) && (subgroupProps.supportedOperations & VK_SUBGROUP_FEATURE_BALLOT_BIT);
+	uint32_t taskSubgroupWorkGroupSize = std::min(taskWorkGroupSize, subgroupProps.subgroupSize);
+
+	if ((meshShaderEXTSupported || meshShaderNVSupported) && !rtxSupported)
+		printf("Mesh shaders are supported but cannot hold a meshlet, using the classic pipeline\n");
+	else if (rtxSupported)
+		printf("Mesh shaders: %s, %d task and %d mesh lanes, task compaction with %s, meshlets of up to %d vertices and %d triangles\n", meshShaderNV ? "NV" : "EXT",
+			int(taskWorkGroupSize), int(meshWorkGroupSize), taskSubgroupsSupported ? "subgroups" : "shared memory", int(meshletLimits.maxVertices), int(meshletLimits.maxTriangles));
+
+	rtxEnabled = rtxSupported;
 
 	uint32_t familyIndex = getGraphicsFamilyIndex(physicalDevice);
 	assert(familyIndex != VK_QUEUE_FAMILY_IGNORED);
 
-	VkDevice device = createDevice(instance, physicalDevice, familyIndex, rtxSupported);
+	VkDevice device = createDevice(instance, physicalDevice, familyIndex, rtxSupported, meshShaderNV);
 	assert(device);
 
 	volkLoadDevice(device);
@@ -918,17 +1082,33 @@ int main(int argc, const char** argv)
 	VkQueue queue = 0;
 	vkGetDeviceQueue(device, familyIndex, 0, &queue);
 
-	VkRenderPass renderPass = createRenderPass(device, swapchainFormat);
+	const VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
+
+	VkRenderPass renderPass = createRenderPass(device, swapchainFormat, depthFormat, false);
 	assert(renderPass);
 
+	VkRenderPass renderPassLate = createRenderPass(device, swapchainFormat, depthFormat, true);
+	assert(renderPassLate);
+
 	rc = false;
 	Shader meshMS = {};
 	Shader meshTS = {};
 	if (rtxSupported) {
-		rc = loadShader(meshMS, device,"shaders/meshlet.mesh.spv");
+		// the .nv.spv variants are the same shaders built with MESH_NV
+		if (smallMeshlets)
+			rc = loadShader(meshMS, device, meshShaderNV ? "shaders/meshlet.mesh.small.nv.spv" : "shaders/meshlet.mesh.small.spv");
+		else
+			rc = loadShader(meshMS, device, meshShaderNV ? "shaders/meshlet.mesh.nv.spv" : "shaders/meshlet.mesh.spv");
 		assert(rc);
 
-		rc = loadShader(meshTS, device, "shaders/meshlet.task.spv");
+		rc = loadShader(meshTS, device, meshShaderNV ? "shaders/meshlet.task.nv.spv" : "shaders/meshlet.task.spv");
+		assert(rc);
+	}
+
+	// the .subgroups.spv variants are built with TASK_SUBGROUPS and declare the ballot capability, so they are only loaded where it is supported
+	Shader meshTSSubgroups = {};
+	if (taskSubgroupsSupported) {
+		rc = loadShader(meshTSSubgroups, device, meshShaderNV ? "shaders/meshlet.task.subgroups.nv.spv" : "shaders/meshlet.task.subgroups.spv");
 		assert(rc);
 	}
 
@@ -940,11 +1120,23 @@ int main(int argc, const char** argv)
 	rc = loadShader(meshFS, device, "shaders/mesh.frag.spv");
 	assert(rc);
 
+	Shader depthreduceCS = {};
+	rc = loadShader(depthreduceCS, device, "shaders/depthreduce.comp.spv");
+	assert(rc);
+
+	Shader drawcullCS = {};
+	rc = loadShader(drawcullCS, device, "shaders/drawcull.comp.spv");
+	assert(rc);
+
+	Shader meshletcullCS = {};
+	rc = loadShader(meshletcullCS, device, "shaders/meshletcull.comp.spv");
+	assert(rc);
+
 	// TODO: this is critical for performance!
 	VkPipelineCache pipelineCache = 0;
 
 	VkDescriptorSetLayout setLayout = createSetLayout(device, { &meshVS, &meshFS });
-	VkPipelineLayout meshLayout = createPipelineLayout(device, setLayout);
+	VkPipelineLayout meshLayout = createPipelineLayout(device, setLayout, VK_SHADER_STAGE_VERTEX_BIT, sizeof(Globals));
 	assert(meshLayout);
 
 	VkDescriptorUpdateTemplate updateTemplate = createUpdateTemplate(device, VK_PIPELINE_BIND_POINT_GRAPHICS, meshLayout, { &meshVS, &meshFS });
@@ -954,7 +1146,7 @@ int main(int argc, const char** argv)
 	VkPipelineLayout meshLayoutRTX = 0;
 	VkDescriptorUpdateTemplate updateTemplateRTX = 0;
 	if (rtxSupported) {
-		meshLayoutRTX = createPipelineLayout(device, setLayoutRTX);
+		meshLayoutRTX = createPipelineLayout(device, setLayoutRTX, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, sizeof(Globals));
 		assert(meshLayoutRTX);
 
 		updateTemplateRTX  = createUpdateTemplate(device, VK_PIPELINE_BIND_POINT_GRAPHICS, meshLayoutRTX, { &meshTS, &meshMS, &meshFS });
@@ -964,14 +1156,62 @@ int main(int argc, const char** argv)
 	VkPipeline meshPipeline = createGraphicsPipeline(device, pipelineCache, renderPass, { &meshVS, &meshFS }, meshLayout);
 	assert(meshPipeline);
 
+	// the task shader compacts visible meshlets with shared memory atomics in meshPipelineRTX and with subgroup ballots in meshPipelineRTXSubgroups
 	VkPipeline meshPipelineRTX = 0;
 	if (rtxSupported) {
-		meshPipelineRTX = createGraphicsPipeline(device, pipelineCache, renderPass, { &meshTS, &meshMS, &meshFS }, meshLayoutRTX);
+		meshPipelineRTX = createGraphicsPipeline(device, pipelineCache, renderPass, { &meshTS, &meshMS, &meshFS }, meshLayoutRTX, { int(taskWorkGroupSize), int(meshWorkGroupSize) });
 		assert(meshPipelineRTX);
 	}
 
+	VkPipeline meshPipelineRTXSubgroups = 0;
+	if (taskSubgroupsSupported) {
+		meshPipelineRTXSubgroups = createGraphicsPipeline(device, pipelineCache, renderPass, { &meshTSSubgroups, &meshMS, &meshFS }, meshLayoutRTX, { int(taskSubgroupWorkGroupSize), int(meshWorkGroupSize) });
+		assert(meshPipelineRTXSubgroups);
+	}
+
+	VkDescriptorSetLayout depthreduceSetLayout = createSetLayout(device, { &depthreduceCS });
+	VkPipelineLayout depthreduceLayout = createPipelineLayout(device, depthreduceSetLayout, 0, 0);
+	assert(depthreduceLayout);
+
+	VkDescriptorUpdateTemplate depthreduceUpdateTemplate = createUpdateTemplate(device, VK_PIPELINE_BIND_POINT_COMPUTE, depthreduceLayout, { &depthreduceCS });
+	assert(depthreduceUpdateTemplate);
+
+	VkPipeline depthreducePipeline = createComputePipeline(device, pipelineCache, depthreduceCS, depthreduceLayout);
+	assert(depthreducePipeline);
+
+	VkDescriptorSetLayout drawcullSetLayout = createSetLayout(device, { &drawcullCS });
+	VkPipelineLayout drawcullLayout = createPipelineLayout(device, drawcullSetLayout, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(Globals));
+	assert(drawcullLayout);
+
+	VkDescriptorUpdateTemplate drawcullUpdateTemplate = createUpdateTemplate(device, VK_PIPELINE_BIND_POINT_COMPUTE, drawcullLayout, { &drawcullCS });
+	assert(drawcullUpdateTemplate);
+
+	VkPipeline drawcullPipeline = createComputePipeline(device, pipelineCache, drawcullCS, drawcullLayout, { int(meshShaderNV) });
+	assert(drawcullPipeline);
+
+	VkDescriptorSetLayout meshletcullSetLayout = createSetLayout(device, { &meshletcullCS });
+	VkPipelineLayout meshletcullLayout = createPipelineLayout(device, meshletcullSetLayout, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(Globals));
+	assert(meshletcullLayout);
+
+	VkDescriptorUpdateTemplate meshletcullUpdateTemplate = createUpdateTemplate(device, VK_PIPELINE_BIND_POINT_COMPUTE, meshletcullLayout, { &meshletcullCS });
+	assert(meshletcullUpdateTemplate);
+
+	VkPipeline meshletcullPipeline = createComputePipeline(device, pipelineCache, meshletcullCS, meshletcullLayout);
+	assert(meshletcullPipeline);
+
+	VkSampler depthSampler = createSampler(device);
+	assert(depthSampler);
+
 	Swapchain swapchain;
-	createSwapchain(swapchain, physicalDevice, device, surface, familyIndex, swapchainFormat, renderPass);
+	createSwapchain(swapchain, physicalDevice, device, surface, familyIndex, swapchainFormat);
+
+	// render targets and framebuffers follow the swapchain size and are created in the frame loop
+	Image depthTarget = {};
+	Image depthPyramid = {};
+	VkImageView depthPyramidMips[16] = {};
+	uint32_t depthPyramidWidth = 0, depthPyramidHeight = 0, depthPyramidLevels = 0;
+	std::vector<VkFramebuffer> framebuffers;
+	uint32_t targetWidth = 0, targetHeight = 0;
 
 	VkQueryPool queryPool = createQueryPool(device, 128);
 	assert(queryPool);
@@ -990,41 +1230,305 @@ int main(int argc, const char** argv)
 	VkPhysicalDeviceMemoryProperties memoryProperties;
 	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
 
-	Mesh mesh;
-	bool rcm = loadMesh(mesh, argv[1]);
-	assert(rcm);
+	double loadStartTime = glfwGetTime();
+	size_t loadStartMemory = getPeakMemoryUsage();
 
-	if (rtxSupported) {
-		buildMeshlets(mesh);
-		buildMeshletCones(mesh);
-	}
+	Scene scene;
+	// both paths cull meshlets, the classic one in meshletcull.comp
+	uint32_t cacheOptions = MeshCache_Meshlets | (compressCache ? MeshCache_Compressed : 0) | (validateCache ? MeshCache_ValidateSource : 0) | (greedyMeshlets ? MeshCache_GreedyMeshlets : 0);
 
-	Buffer vb = {};
-	createBuffer(vb, device, memoryProperties, mesh.vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	Buffer scratchVB = {};
-	createBuffer(scratchVB, device, memoryProperties, mesh.vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	uploadBuffer(device, commandPool, commandBuffer, queue, vb, scratchVB, mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+	// meshes load in the background while the window is already rendering; finished chunks are uploaded at the start of each frame
+	MeshLoader loader;
+	startMeshLoader(loader, meshPaths, cacheOptions, meshletLimits, lowMemory);
 
-	Buffer ib = {};
-	createBuffer(ib, device, memoryProperties, mesh.indices.size() * sizeof(unsigned int), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	Buffer scratchIB = {};
-	createBuffer(scratchIB, device, memoryProperties, mesh.indices.size() * sizeof(unsigned int), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	uploadBuffer(device, commandPool, commandBuffer, queue, ib, scratchIB, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+	bool loadReported = false;
+	bool firstFrameReported = false;
+
+	// GPU frame time with shared memory and with subgroup compaction, summed over the frames of the running benchmark
+	double taskBenchmarkTime[2] = {};
+
+	// a backlog of chunks is spread over several frames instead of stalling one
+	const size_t kUploadBudget = 32 << 20;
+
+	// compacted triangles of the classic path, see cib
+	const size_t kCompactedIndexBudget = size_t(512) << 20;
 
+	Buffer scratch = {};
+	createBuffer(scratch, device, memoryProperties, kUploadBudget, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	// scene buffers start out empty and grow as chunks arrive, so they are copied on the GPU as well as written
+	const VkBufferUsageFlags kTransferUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	auto updateBuffer = [&](Buffer& buffer, VkBufferUsageFlags usage, const void* data, size_t size, size_t offset) {
+		growBuffer(buffer, device, memoryProperties, commandPool, commandBuffer, queue, size, usage | kTransferUsage);
+		uploadBuffer(device, commandPool, commandBuffer, queue, buffer, scratch, static_cast<const char*>(data) + offset, size - offset, offset);
+	};
+
+	// new meshlets and draws start out invisible, so the second pass of their first frame is what draws them
+	auto clearBuffer = [&](Buffer& buffer, VkBufferUsageFlags usage, size_t size, size_t offset) {
+		growBuffer(buffer, device, memoryProperties, commandPool, commandBuffer, queue, size, usage | kTransferUsage);
+
+		if (size > offset)
+			fillBuffer(device, commandPool, commandBuffer, queue, buffer, 0, size - offset, offset);
+	};
+
+	// LODs that drawcull.comp selects from, rebuilt when chunks arrive; the CPU does not touch draws after that
+	std::vector<MeshLods> meshLods;
+	std::vector<LodRange> lodRanges;
+	uint32_t maxTaskCount = 0;
+
+	Buffer vb = {};
+	Buffer ib = {};
 	Buffer mb = {};
-	Buffer scratchMB = {};
-	if (rtxSupported) {
-		createBuffer(mb, device, memoryProperties, mesh.meshlets.size() * sizeof(Meshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		createBuffer(scratchMB, device, memoryProperties, mesh.meshlets.size() * sizeof(Meshlet), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		uploadBuffer(device, commandPool, commandBuffer, queue, mb, scratchMB, mesh.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet));
-	}
+	Buffer msb = {};
+	Buffer mcb = {};
+	Buffer gsb = {};
+	Buffer gcb = {};
+	Buffer mvb = {};
+	Buffer mtb = {};
+	Buffer drb = {};
+	Buffer mlb = {};
+	Buffer lrb = {};
+
+	// drawcull.comp appends a command to tb and to dcb for every draw it keeps, and their count to ccnt; both paths draw with that count
+	// dvisb and mvisb have the per-draw and per-meshlet visibility from the previous frame's second pass
+	Buffer tb = {};
+	Buffer dcb = {};
+	Buffer dvisb = {};
+	Buffer mvisb = {};
+
+	Buffer ccnt = {};
+	createBuffer(ccnt, device, memoryProperties, sizeof(CullCounts), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | kTransferUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	fillBuffer(device, commandPool, commandBuffer, queue, ccnt, 0, sizeof(CullCounts));
+
+	// the statistics of the last frame are copied back for the title
+	Buffer ccntReadback = {};
+	createBuffer(ccntReadback, device, memoryProperties, sizeof(CullCounts), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	memset(ccntReadback.data, 0, sizeof(CullCounts));
+
+	// the classic path draws the triangles of visible meshlets, which meshletcull.comp copies from the meshlet data into cib
+	Buffer cib = {};
+
+	// with CPU culling the classic path draws ccb, one command per run of visible meshlets, from the meshlet triangles in mib instead
+	std::vector<MeshTaskCommand> taskCommands;
+	MeshletCullData cullData;
+	std::vector<VkDrawIndexedIndirectCommand> cpuCommands;
+	Buffer mib = {};
+	Buffer ccb = {};
+
+	// meshes are lined up along +X starting at the origin with unit radius, and their instances extend along -Z, see appendMeshChunk
+	Camera camera = {};
+	camera.position = { 0.f, 0.f, 3.f };
+
+	double lastFrameTime = glfwGetTime();
 
 	while (!glfwWindowShouldClose(window))
 	{
 		double frameCpuTime = glfwGetTime() * 1000.0;
 		glfwPollEvents();
 
-		resizeSwapchainIfNecessary(swapchain, physicalDevice, device, surface, familyIndex, swapchainFormat, renderPass);
+		updateCamera(camera, window, float(frameCpuTime / 1000.0 - lastFrameTime));
+		lastFrameTime = frameCpuTime / 1000.0;
+
+		// done has to be read before draining so that chunks pushed before it was set are not missed
+		bool loaderDone = loader.done;
+		bool drained = false;
+
+		size_t drawCount = scene.draws.size();
+		size_t meshletVisibilityCount = scene.meshletVisibilityCount;
+		size_t vertexCount = scene.vertices.size();
+		size_t indexCount = scene.indices.size();
+		size_t meshletCount = scene.meshlets.size();
+		size_t groupCount = scene.groupSpheres.size();
+		size_t meshletVertexCount = scene.meshletVertices.size();
+		size_t meshletTriangleCount = scene.meshletTriangles.size();
+		size_t chunkCount = 0;
+		size_t uploadSize = 0;
+
+		while (!drained && uploadSize < kUploadBudget) {
+			MeshChunk chunk;
+
+			if (loader.chunks.pop(chunk)) {
+				appendMeshChunk(scene, chunk, instanceCount);
+				chunkCount++;
+
+				uploadSize = (scene.vertices.size() - vertexCount) * sizeof(Vertex) + (scene.indices.size() - indexCount) * sizeof(uint32_t) + (scene.meshlets.size() - meshletCount) * (sizeof(Meshlet) + sizeof(MeshletSphere) + sizeof(uint32_t)) +
+					(scene.meshletVertices.size() - meshletVertexCount) * sizeof(uint32_t) + (scene.meshletTriangles.size() - meshletTriangleCount) + (scene.draws.size() - drawCount) * sizeof(MeshDraw);
+			}
+			else
+				drained = true;
+		}
+
+		if (chunkCount) {
+			updateBuffer(vb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene.vertices.data(), scene.vertices.size() * sizeof(Vertex), vertexCount * sizeof(Vertex));
+			updateBuffer(ib, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, scene.indices.data(), scene.indices.size() * sizeof(uint32_t), indexCount * sizeof(uint32_t));
+			updateBuffer(drb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene.draws.data(), scene.draws.size() * sizeof(MeshDraw), drawCount * sizeof(MeshDraw));
+			updateBuffer(mb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene.meshlets.data(), scene.meshlets.size() * sizeof(Meshlet), meshletCount * sizeof(Meshlet));
+			updateBuffer(msb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene.meshletSpheres.data(), scene.meshletSpheres.size() * sizeof(MeshletSphere), meshletCount * sizeof(MeshletSphere));
+			updateBuffer(mcb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene.meshletCones.data(), scene.meshletCones.size() * sizeof(uint32_t), meshletCount * sizeof(uint32_t));
+			updateBuffer(gsb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene.groupSpheres.data(), scene.groupSpheres.size() * sizeof(MeshletSphere), groupCount * sizeof(MeshletSphere));
+			updateBuffer(gcb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene.groupCones.data(), scene.groupCones.size() * sizeof(uint32_t), groupCount * sizeof(uint32_t));
+			updateBuffer(mvb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene.meshletVertices.data(), scene.meshletVertices.size() * sizeof(uint32_t), meshletVertexCount * sizeof(uint32_t));
+			updateBuffer(mtb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene.meshletTriangles.data(), scene.meshletTriangles.size(), meshletTriangleCount);
+			clearBuffer(mvisb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene.meshletVisibilityCount / 8, meshletVisibilityCount / 8);
+			clearBuffer(dvisb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scene.draws.size() * sizeof(uint32_t), drawCount * sizeof(uint32_t));
+
+			// which LODs are complete only changes when chunks arrive; the selection among them happens on the GPU every frame
+			buildLodRanges(meshLods, lodRanges, scene);
+			updateBuffer(mlb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, meshLods.data(), meshLods.size() * sizeof(MeshLods), 0);
+			updateBuffer(lrb, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, lodRanges.data(), lodRanges.size() * sizeof(LodRange), 0);
+
+			maxTaskCount = 0;
+			for (const LodRange& lod : lodRanges)
+				maxTaskCount = std::max(maxTaskCount, (lod.meshletCount + kMeshletGroupSize - 1) / kMeshletGroupSize);
+
+			// every draw can be kept, and meshletcull.comp runs a row of workgroups per command, with the commands spread over rows and layers
+			growBuffer(tb, device, memoryProperties, commandPool, commandBuffer, queue, scene.draws.size() * sizeof(MeshTaskCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | kTransferUsage);
+			growBuffer(dcb, device, memoryProperties, commandPool, commandBuffer, queue, scene.draws.size() * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | kTransferUsage);
+
+			// visible meshlets are copied into a range of cib that drawcull.comp gives every command, with room for the whole LOD; the full mesh of
+			// every draw fits unless that exceeds the budget, which only many instances do, and then the classic path skips commands that do not fit
+			// and the title reports how many it skipped
+			size_t compactedIndexCount = 0;
+
+			for (const MeshDraw& draw : scene.draws)
+				compactedIndexCount += lodRanges[meshLods[draw.meshIndex].lodOffset].indexCount;
+
+			compactedIndexCount = std::min(compactedIndexCount, kCompactedIndexBudget / sizeof(uint32_t));
+
+			growBuffer(cib, device, memoryProperties, commandPool, commandBuffer, queue, compactedIndexCount * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | kTransferUsage);
+		}
+
+		if (loaderDone && drained && !loadReported) {
+			printf("Loaded %d meshes (%d draws) in %.2f ms\n", int(scene.meshes.size()), int(scene.draws.size()), (glfwGetTime() - loadStartTime) * 1000.0);
+
+			printf("Vertex format: %s, %d bytes per vertex\n", kVertexFormatNames[VERTEX_FORMAT], int(sizeof(Vertex)));
+
+			size_t meshletCullSize = scene.meshletSpheres.size() * sizeof(MeshletSphere) + scene.meshletCones.size() * sizeof(uint32_t);
+			size_t meshletDataSize = scene.meshlets.size() * sizeof(Meshlet) + meshletCullSize + scene.meshletVertices.size() * sizeof(uint32_t) + scene.meshletTriangles.size();
+
+			printf("Peak memory: %.1f MB before load, %.1f MB after load; mesh data %.1f MB\n",
+				double(loadStartMemory) / (1024 * 1024), double(getPeakMemoryUsage()) / (1024 * 1024),
+				double(scene.vertices.size() * sizeof(Vertex) + scene.indices.size() * sizeof(uint32_t) + meshletDataSize) / (1024 * 1024));
+
+			// the previous layout stored 64 vertices and 126 triangles in every meshlet and padded every LOD to a multiple of 32 meshlets
+			const size_t kFixedMeshletSize = 656;
+			size_t fixedMeshletCount = 0;
+
+			for (const MeshLod& lod : scene.lods)
+				fixedMeshletCount += (lod.meshletCount + 31) & ~31u;
+
+			printf("Meshlet memory: %.2f MB packed (%.2f MB culling data, %.2f MB headers, %.2f MB vertex lists, %.2f MB triangle lists), %.2f MB with fixed size meshlets\n",
+				double(meshletDataSize) / (1024 * 1024), double(meshletCullSize) / (1024 * 1024), double(scene.meshlets.size() * sizeof(Meshlet)) / (1024 * 1024),
+				double(scene.meshletVertices.size() * sizeof(uint32_t)) / (1024 * 1024), double(scene.meshletTriangles.size()) / (1024 * 1024),
+				double(fixedMeshletCount * kFixedMeshletSize) / (1024 * 1024));
+
+			loadReported = true;
+		}
+
+		resizeSwapchainIfNecessary(swapchain, physicalDevice, device, surface, familyIndex, swapchainFormat);
+
+		// nothing from the previous frame is in flight any more, see vkDeviceWaitIdle at the end of the loop
+		if (targetWidth != swapchain.width || targetHeight != swapchain.height) {
+			for (VkFramebuffer framebuffer : framebuffers)
+				vkDestroyFramebuffer(device, framebuffer, 0);
+
+			for (uint32_t i = 0; i < depthPyramidLevels; ++i)
+				vkDestroyImageView(device, depthPyramidMips[i], 0);
+
+			destroyImage(depthTarget, device);
+			destroyImage(depthPyramid, device);
+
+			createImage(depthTarget, device, memoryProperties, swapchain.width, swapchain.height, 1, depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+
+			depthPyramidWidth = previousPow2(swapchain.width);
+			depthPyramidHeight = previousPow2(swapchain.height);
+			depthPyramidLevels = getImageMipLevels(depthPyramidWidth, depthPyramidHeight);
+			assert(depthPyramidLevels <= ARRAYSIZE(depthPyramidMips));
+
+			createImage(depthPyramid, device, memoryProperties, depthPyramidWidth, depthPyramidHeight, depthPyramidLevels, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
+
+			for (uint32_t i = 0; i < depthPyramidLevels; ++i)
+				depthPyramidMips[i] = createImageView(device, depthPyramid.image, VK_FORMAT_R32_SFLOAT, i, 1);
+
+			framebuffers.resize(swapchain.imageCount);
+			for (uint32_t i = 0; i < swapchain.imageCount; ++i)
+				framebuffers[i] = createFramebuffer(device, renderPass, swapchain.imageViews[i], depthTarget.imageView, swapchain.width, swapchain.height);
+
+			targetWidth = swapchain.width;
+			targetHeight = swapchain.height;
+		}
+
+		const float kFovY = 70.f * 3.14159265f / 180.f;
+		const float kNear = 0.05f;
+
+		Globals globals = {};
+		globals.view = viewMatrix(camera.position, getOrientation(camera));
+		globals.projection[1] = 1.f / tanf(kFovY / 2.f);
+		globals.projection[0] = globals.projection[1] * float(swapchain.height) / float(swapchain.width);
+		globals.projection[2] = kNear;
+
+		// a view space point is inside the right half of the frustum when P00 * x + z <= 0; normalizing the plane turns that into a distance
+		float frustumX = sqrtf(globals.projection[0] * globals.projection[0] + 1.f);
+		float frustumY = sqrtf(globals.projection[1] * globals.projection[1] + 1.f);
+
+		globals.frustum[0] = globals.projection[0] / frustumX;
+		globals.frustum[1] = 1.f / frustumX;
+		globals.frustum[2] = globals.projection[1] / frustumY;
+		globals.frustum[3] = 1.f / frustumY;
+
+		// there is no depth pyramid on the CPU, so CPU culling draws everything that passes in one pass
+		bool cpuCulling = cpuCullEnabled && !rtxEnabled;
+
+		globals.occlusion = occlusionEnabled && !cpuCulling;
+
+		if (taskBenchmarkFrames > 0 && !(rtxEnabled && taskSubgroupsSupported)) {
+			printf("Task compaction benchmark needs mesh shaders with subgroup support in task shaders\n");
+			taskBenchmarkFrames = 0;
+		}
+
+		// the benchmark alternates frames, so both pipelines see the same view and the same clocks
+		bool taskBenchmark = taskBenchmarkFrames > 0;
+		bool taskSubgroups = taskSubgroupsSupported && (taskBenchmark ? (taskBenchmarkFrames & 1) != 0 : taskSubgroupsEnabled);
+
+		if (taskBenchmarkFrames == kTaskBenchmarkFrames) {
+			taskBenchmarkTime[0] = 0;
+			taskBenchmarkTime[1] = 0;
+		}
+
+		globals.screen[0] = float(swapchain.width);
+		globals.screen[1] = float(swapchain.height);
+		globals.triangleCulling = triangleCullEnabled;
+
+		// LODs may deviate by up to a pixel; at distance d a pixel spans 2 * d / (P11 * height) world units
+		globals.lodThreshold = lodEnabled ? 2.f / (globals.projection[1] * float(swapchain.height)) : 0.f;
+
+		double cullTime = 0;
+		size_t cullMeshletCount = 0;
+
+		if (cpuCulling) {
+			// the meshlet triangles are expanded to scene indices only once CPU culling is used, and then only for meshlets that are new since
+			if (cullData.centerX.size() < scene.meshlets.size()) {
+				size_t meshletIndexCount = cullData.indices.size();
+				updateMeshletCullData(cullData, scene);
+				updateBuffer(mib, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, cullData.indices.data(), cullData.indices.size() * sizeof(uint32_t), meshletIndexCount * sizeof(uint32_t));
+			}
+
+			buildMeshTaskCommands(taskCommands, scene, camera.position, globals.lodThreshold);
+
+			CullCamera cullCamera = {};
+			cullCamera.view = globals.view;
+			memcpy(cullCamera.projection, globals.projection, sizeof(globals.projection));
+			memcpy(cullCamera.frustum, globals.frustum, sizeof(globals.frustum));
+			cullCamera.position = camera.position;
+
+			double cullStart = glfwGetTime();
+			cullMeshletCount = cullMeshlets(cpuCommands, cullData, scene, taskCommands, cullCamera);
+			cullTime = (glfwGetTime() - cullStart) * 1000.0;
+
+			if (!cpuCommands.empty())
+				updateBuffer(ccb, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, cpuCommands.data(), cpuCommands.size() * sizeof(VkDrawIndexedIndirectCommand), 0);
+		}
 
 		uint32_t imageIndex = 0;
 		VK_CHECK(vkAcquireNextImageKHR(device, swapchain.swapchain, ~0ull, acquireSemaphore, VK_NULL_HANDLE, &imageIndex));
@@ -1042,45 +1546,189 @@ int main(int argc, const char** argv)
 		VkImageMemoryBarrier renderBeginBarrier = imageBarrier(swapchain.images[imageIndex], 0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &renderBeginBarrier);
 
-		VkClearColorValue color = { 48.f / 255.f, 10.f / 255.f, 36.f / 255.f, 1 };
-		VkClearValue clearColor = { color };
+		// the pyramid is rebuilt before anything reads it; it stays in GENERAL since levels are written as storage images and read as sampled ones
+		VkImageMemoryBarrier pyramidBeginBarrier = imageBarrier(depthPyramid.image, 0, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 1, &pyramidBeginBarrier);
 
-		VkRenderPassBeginInfo passBeginInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
-		passBeginInfo.renderPass = renderPass;
-		passBeginInfo.framebuffer = swapchain.framebuffers[imageIndex];
-		passBeginInfo.renderArea.extent.width = swapchain.width;
-		passBeginInfo.renderArea.extent.height = swapchain.height;
-		passBeginInfo.clearValueCount = 1;
-		passBeginInfo.pClearValues = &clearColor;
+		VkClearColorValue color = { 48.f / 255.f, 10.f / 255.f, 36.f / 255.f, 1 };
 
-		vkCmdBeginRenderPass(commandBuffer, &passBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		VkClearValue clearValues[2] = {};
+		clearValues[0].color = color;
+		clearValues[1].depthStencil = { 0.f, 0 };
 
 		VkViewport viewport = { 0, float(swapchain.height), float(swapchain.width), -float(swapchain.height), 0, 1 };
 		VkRect2D scissor = { {0, 0}, {uint32_t(swapchain.width), uint32_t(swapchain.height)} };
 
-		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+		DescriptorInfo pyramidDesc(depthSampler, depthPyramid.imageView, VK_IMAGE_LAYOUT_GENERAL);
 
-		if (rtxEnabled) {
-			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipelineRTX);
+		VkPipelineStageFlags taskStage = rtxSupported ? VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT : 0;
 
-			DescriptorInfo descriptors[] = {vb.buffer, mb.buffer};
-			vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, updateTemplateRTX, meshLayoutRTX, 0, descriptors);
+		// drawcull.comp culls draws and selects their LODs for both paths; the classic path then culls meshlets in meshletcull.comp, which appends
+		// the triangles of visible meshlets to the commands, while the task shader does that for the mesh path
+		auto cull = [&](bool late) {
+			globals.late = late;
 
-			vkCmdDrawMeshTasksNV(commandBuffer, uint32_t(mesh.meshlets.size()) / 32, 0);
-		}
-		else {
-			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline);
+			// the counts were read by the previous pass's draws; the statistics are only reset by the first pass, so they cover the final pass of the frame
+			VkBufferMemoryBarrier resetBarrier = bufferBarrier(ccnt.buffer, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 1, &resetBarrier, 0, 0);
+
+			// meshletcull.comp loops over the groups of LODs that have more than the device can dispatch along X
+			CullCounts counts = {};
+			counts.maxTaskCount = std::min(maxTaskCount, props.limits.maxComputeWorkGroupCount[0]);
+			counts.compactedIndexCapacity = uint32_t(std::min(cib.size / sizeof(uint32_t), size_t(~0u)));
+
+			vkCmdUpdateBuffer(commandBuffer, ccnt.buffer, 0, late ? offsetof(CullCounts, drawCount) : sizeof(CullCounts), &counts);
+
+			VkBufferMemoryBarrier countsBarrier = bufferBarrier(ccnt.buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 1, &countsBarrier, 0, 0);
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, drawcullPipeline);
+
+			DescriptorInfo drawcullDescriptors[] = { DescriptorInfo(drb.buffer, 0, scene.draws.size() * sizeof(MeshDraw)), mlb.buffer, lrb.buffer, tb.buffer, dcb.buffer, ccnt.buffer, dvisb.buffer, pyramidDesc };
+			vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, drawcullUpdateTemplate, drawcullLayout, 0, drawcullDescriptors);
+			vkCmdPushConstants(commandBuffer, drawcullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(globals), &globals);
+
+			vkCmdDispatch(commandBuffer, uint32_t((scene.draws.size() + 63) / 64), 1, 1);
+
+			VkBufferMemoryBarrier drawcullBarriers[] = {
+				bufferBarrier(ccnt.buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT),
+				bufferBarrier(tb.buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT),
+				bufferBarrier(dcb.buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT),
+			};
+
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | taskStage, 0, 0, 0, ARRAYSIZE(drawcullBarriers), drawcullBarriers, 0, 0);
+
+			if (rtxEnabled)
+				return;
+
+			// one row of workgroups per command, as many as the largest LOD has groups of meshlets; rows are stacked along Y and then Z
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletcullPipeline);
+
+			DescriptorInfo meshletcullDescriptors[] = { mb.buffer, drb.buffer, mvb.buffer, mtb.buffer, tb.buffer, dcb.buffer, mvisb.buffer, pyramidDesc, cib.buffer, msb.buffer, mcb.buffer, gsb.buffer, gcb.buffer, ccnt.buffer };
+			vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, meshletcullUpdateTemplate, meshletcullLayout, 0, meshletcullDescriptors);
+			vkCmdPushConstants(commandBuffer, meshletcullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(globals), &globals);
+
+			vkCmdDispatchIndirect(commandBuffer, ccnt.buffer, offsetof(CullCounts, maxTaskCount));
+
+			VkBufferMemoryBarrier cullBarriers[] = {
+				bufferBarrier(dcb.buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT),
+				bufferBarrier(cib.buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDEX_READ_BIT),
+			};
+
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, 0, ARRAYSIZE(cullBarriers), cullBarriers, 0, 0);
+		};
+
+		auto render = [&](bool late) {
+			globals.late = late;
+
+			VkRenderPassBeginInfo passBeginInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+			passBeginInfo.renderPass = late ? renderPassLate : renderPass;
+			passBeginInfo.framebuffer = framebuffers[imageIndex];
+			passBeginInfo.renderArea.extent.width = swapchain.width;
+			passBeginInfo.renderArea.extent.height = swapchain.height;
+			passBeginInfo.clearValueCount = ARRAYSIZE(clearValues);
+			passBeginInfo.pClearValues = clearValues;
+
+			vkCmdBeginRenderPass(commandBuffer, &passBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+			vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+			vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+			if (scene.meshes.empty()) {
+				// nothing has been loaded yet
+			}
+			else if (rtxEnabled) {
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, taskSubgroups ? meshPipelineRTXSubgroups : meshPipelineRTX);
+
+				DescriptorInfo descriptors[] = { vb.buffer, mb.buffer, drb.buffer, mvb.buffer, mtb.buffer, tb.buffer, mvisb.buffer, pyramidDesc, msb.buffer, mcb.buffer, gsb.buffer, gcb.buffer };
+				vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, updateTemplateRTX, meshLayoutRTX, 0, descriptors);
+				vkCmdPushConstants(commandBuffer, meshLayoutRTX, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(globals), &globals);
+
+				// one indirect call for the whole scene; each command covers one draw's meshlets, and the stride skips the fields only the task shader reads
+				if (meshShaderNV)
+					vkCmdDrawMeshTasksIndirectCountNV(commandBuffer, tb.buffer, 0, ccnt.buffer, 0, uint32_t(scene.draws.size()), sizeof(MeshTaskCommand));
+				else
+					vkCmdDrawMeshTasksIndirectCountEXT(commandBuffer, tb.buffer, 0, ccnt.buffer, 0, uint32_t(scene.draws.size()), sizeof(MeshTaskCommand));
+			}
+			else {
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline);
+
+				DescriptorInfo descriptors[] = { vb.buffer, drb.buffer };
+				vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, updateTemplate, meshLayout, 0, descriptors);
+				vkCmdPushConstants(commandBuffer, meshLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(globals), &globals);
+
+				if (cpuCulling) {
+					if (!cpuCommands.empty()) {
+						vkCmdBindIndexBuffer(commandBuffer, mib.buffer, 0, VK_INDEX_TYPE_UINT32);
+						vkCmdDrawIndexedIndirect(commandBuffer, ccb.buffer, 0, uint32_t(cpuCommands.size()), sizeof(VkDrawIndexedIndirectCommand));
+					}
+				}
+				else {
+					vkCmdBindIndexBuffer(commandBuffer, cib.buffer, 0, VK_INDEX_TYPE_UINT32);
+					vkCmdDrawIndexedIndirectCount(commandBuffer, dcb.buffer, 0, ccnt.buffer, 0, uint32_t(scene.draws.size()), sizeof(VkDrawIndexedIndirectCommand));
+				}
+			}
+
+			vkCmdEndRenderPass(commandBuffer);
+		};
+
+		// first pass: whatever was visible at the end of the previous frame
+		if (!scene.meshes.empty() && !cpuCulling)
+			cull(false);
+
+		render(false);
+
+		// second pass: everything else that is not hidden behind the first pass's depth
+		if (!scene.meshes.empty() && globals.occlusion) {
+			VkImageMemoryBarrier depthReadBarrier = imageBarrier(depthTarget.image, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 1, &depthReadBarrier);
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthreducePipeline);
+
+			for (uint32_t i = 0; i < depthPyramidLevels; ++i) {
+				DescriptorInfo sourceDepth = (i == 0)
+					? DescriptorInfo(depthSampler, depthTarget.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+					: DescriptorInfo(depthSampler, depthPyramidMips[i - 1], VK_IMAGE_LAYOUT_GENERAL);
+
+				DescriptorInfo descriptors[] = { DescriptorInfo(depthPyramidMips[i], VK_IMAGE_LAYOUT_GENERAL), sourceDepth };
+				vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, depthreduceUpdateTemplate, depthreduceLayout, 0, descriptors);
+
+				uint32_t levelWidth = std::max(depthPyramidWidth >> i, 1u);
+				uint32_t levelHeight = std::max(depthPyramidHeight >> i, 1u);
+
+				vkCmdDispatch(commandBuffer, (levelWidth + 31) / 32, (levelHeight + 31) / 32, 1);
+
+				VkImageMemoryBarrier reduceBarrier = imageBarrier(depthPyramid.image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 1, &reduceBarrier);
+			}
+
+			// the culling in the second pass reads the pyramid; this also orders its visibility writes after the first pass's reads
+			VkPipelineStageFlags cullStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | taskStage;
+
+			// the second render pass also loads the color the first one stored
+			VkImageMemoryBarrier lateBarriers[] = {
+				imageBarrier(depthTarget.image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT),
+				imageBarrier(swapchain.images[imageIndex], VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+			};
 
-			DescriptorInfo descriptors[] = { vb.buffer };
-			vkCmdPushDescriptorSetWithTemplateKHR(commandBuffer, updateTemplate, meshLayout, 0, descriptors);
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | cullStages,
+				0, 0, 0, 0, 0, ARRAYSIZE(lateBarriers), lateBarriers);
 
-			vkCmdBindIndexBuffer(commandBuffer, ib.buffer, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdDrawIndexed(commandBuffer, uint32_t(mesh.indices.size()), 1, 0, 0, 0);
-			//vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+			cull(true);
+
+			render(true);
 		}
 
-		vkCmdEndRenderPass(commandBuffer);
+		if (!scene.meshes.empty() && !cpuCulling) {
+			VkBufferMemoryBarrier readbackBarrier = bufferBarrier(ccnt.buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 1, &readbackBarrier, 0, 0);
+
+			VkBufferCopy region = { 0, 0, sizeof(CullCounts) };
+			vkCmdCopyBuffer(commandBuffer, ccnt.buffer, ccntReadback.buffer, 1, &region);
+
+			VkBufferMemoryBarrier hostBarrier = bufferBarrier(ccntReadback.buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT);
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, 0, 1, &hostBarrier, 0, 0);
+		}
 
 		VkImageMemoryBarrier renderEndBarrier = imageBarrier(swapchain.images[imageIndex], VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
 		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &renderEndBarrier);
@@ -1112,36 +1760,132 @@ int main(int argc, const char** argv)
 
 		VK_CHECK(vkDeviceWaitIdle(device));
 
+		if (!firstFrameReported) {
+			printf("First frame in %.2f ms\n", (glfwGetTime() - loadStartTime) * 1000.0);
+			firstFrameReported = true;
+		}
+
 		uint64_t queryResults[2];
 		VK_CHECK(vkGetQueryPoolResults(device, queryPool, 0, ARRAYSIZE(queryResults), sizeof(queryResults), queryResults, sizeof(queryResults[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
 
 		double frameGpuTime = double(queryResults[0]) * props.limits.timestampPeriod * 1e-6;
 		double endGpuTime = double(queryResults[1]) * props.limits.timestampPeriod * 1e-6;
 
+		if (taskBenchmark) {
+			taskBenchmarkTime[taskSubgroups] += endGpuTime - frameGpuTime;
+
+			if (--taskBenchmarkFrames == 0) {
+				double sharedTime = taskBenchmarkTime[0] / (kTaskBenchmarkFrames / 2);
+				double subgroupTime = taskBenchmarkTime[1] / (kTaskBenchmarkFrames / 2);
+
+				printf("Task compaction over %d frames: shared memory %.3f ms, subgroups %.3f ms (%.2fx)\n", kTaskBenchmarkFrames, sharedTime, subgroupTime, sharedTime / subgroupTime);
+			}
+		}
+
 		double endCpuTime = glfwGetTime() * 1000.0;
-		char title[256];
-		sprintf(title, "cpu %.1f ms; gpu %.3f ms; triangles %d; meshlets %d RTX %s", endCpuTime - frameCpuTime, endGpuTime - frameGpuTime, int(mesh.indices.size() / 3),
-			int(mesh.meshlets.size()), rtxEnabled ? "ON" : "OFF");
+		// counts are for the selected LODs of the draws that pass draw culling, before meshlet culling; CPU culling has no draw culling
+		size_t visibleDrawCount = 0;
+		size_t triangleCount = 0;
+		size_t drawnMeshletCount = 0;
+		size_t droppedDrawCount = 0;
+
+		if (cpuCulling) {
+			visibleDrawCount = taskCommands.size();
+
+			for (const MeshTaskCommand& command : taskCommands) {
+				for (uint32_t i = 0; i < command.meshletCount; ++i)
+					triangleCount += scene.meshlets[command.meshletOffset + i].triangleCount;
+
+				drawnMeshletCount += command.meshletCount;
+			}
+		}
+		else {
+			const CullCounts& counts = *static_cast<const CullCounts*>(ccntReadback.data);
+
+			visibleDrawCount = counts.drawCount;
+			triangleCount = counts.triangleCount;
+			drawnMeshletCount = counts.meshletCount;
+
+			// only the classic path draws from cib
+			droppedDrawCount = rtxEnabled ? 0 : counts.droppedCount;
+		}
+
+		// throughput is per core of the whole machine, since cullMeshlets spreads the work over all of them
+		char cullStats[64] = "";
+		if (cpuCulling && cullTime > 0)
+			snprintf(cullStats, ARRAYSIZE(cullStats), " (%.2f ms, %.0f meshlets/ms/core)", cullTime, double(cullMeshletCount) / cullTime / getThreadCount());
+
+		// draws past the compacted index budget are not drawn at all, and which ones depends on the order drawcull.comp appends them in
+		char droppedStats[64] = "";
+		if (droppedDrawCount > 0)
+			snprintf(droppedStats, ARRAYSIZE(droppedStats), "; %d dropped over index budget", int(droppedDrawCount));
+
+		char title[320];
+		sprintf(title, "cpu %.1f ms; gpu %.3f ms; meshes %d; draws %d%s; triangles %d; meshlets %d RTX %s LOD %s OC %s TC %s SG %s CPU cull %s%s", endCpuTime - frameCpuTime, endGpuTime - frameGpuTime, int(scene.meshes.size()),
+			int(visibleDrawCount), droppedStats, int(triangleCount), int(drawnMeshletCount), rtxEnabled ? "ON" : "OFF", lodEnabled ? "ON" : "OFF", occlusionEnabled ? "ON" : "OFF", triangleCullEnabled ? "ON" : "OFF", taskSubgroups ? "ON" : "OFF", cpuCullEnabled ? "ON" : "OFF", cullStats);
 		glfwSetWindowTitle(window, title);
 	}
 
+	stopMeshLoader(loader);
+
 	VK_CHECK(vkDeviceWaitIdle(device));
 
-	if (rtxSupported) {
-		destroyBuffer(mb, device);
-		destroyBuffer(scratchMB, device);
-	}
+	// buffers that never received data are null, which vkDestroyBuffer and vkFreeMemory accept
+	destroyBuffer(mb, device);
+	destroyBuffer(msb, device);
+	destroyBuffer(mcb, device);
+	destroyBuffer(gsb, device);
+	destroyBuffer(gcb, device);
+	destroyBuffer(mvb, device);
+	destroyBuffer(mtb, device);
+	destroyBuffer(tb, device);
 	destroyBuffer(vb, device);
-	destroyBuffer(scratchVB, device);
 	destroyBuffer(ib, device);
-	destroyBuffer(scratchIB, device);
+	destroyBuffer(drb, device);
+	destroyBuffer(mlb, device);
+	destroyBuffer(lrb, device);
+	destroyBuffer(dcb, device);
+	destroyBuffer(dvisb, device);
+	destroyBuffer(mvisb, device);
+	destroyBuffer(ccnt, device);
+	destroyBuffer(ccntReadback, device);
+	destroyBuffer(cib, device);
+	destroyBuffer(mib, device);
+	destroyBuffer(ccb, device);
+	destroyBuffer(scratch, device);
 
 	vkDestroyCommandPool(device, commandPool, 0);
 
 	vkDestroyQueryPool(device, queryPool, 0);
 
+	for (VkFramebuffer framebuffer : framebuffers)
+		vkDestroyFramebuffer(device, framebuffer, 0);
+
+	for (uint32_t i = 0; i < depthPyramidLevels; ++i)
+		vkDestroyImageView(device, depthPyramidMips[i], 0);
+
+	destroyImage(depthTarget, device);
+	destroyImage(depthPyramid, device);
+
 	destroySwapchain(device, swapchain);
 
+	vkDestroySampler(device, depthSampler, 0);
+
+	vkDestroyPipeline(device, depthreducePipeline, 0);
+	vkDestroyDescriptorUpdateTemplate(device, depthreduceUpdateTemplate, 0);
+	vkDestroyPipelineLayout(device, depthreduceLayout, 0);
+	vkDestroyDescriptorSetLayout(device, depthreduceSetLayout, 0);
+
+	vkDestroyPipeline(device, drawcullPipeline, 0);
+	vkDestroyDescriptorUpdateTemplate(device, drawcullUpdateTemplate, 0);
+	vkDestroyPipelineLayout(device, drawcullLayout, 0);
+	vkDestroyDescriptorSetLayout(device, drawcullSetLayout, 0);
+
+	vkDestroyPipeline(device, meshletcullPipeline, 0);
+	vkDestroyDescriptorUpdateTemplate(device, meshletcullUpdateTemplate, 0);
+	vkDestroyPipelineLayout(device, meshletcullLayout, 0);
+	vkDestroyDescriptorSetLayout(device, meshletcullSetLayout, 0);
+
 	vkDestroyPipeline(device, meshPipeline, 0);
 
 	vkDestroyDescriptorUpdateTemplate(device, updateTemplate, 0);
@@ -1150,6 +1894,7 @@ int main(int argc, const char** argv)
 	vkDestroyDescriptorSetLayout(device, setLayout, 0);
 	if (rtxSupported) {
 		vkDestroyPipeline(device, meshPipelineRTX, 0);
+		vkDestroyPipeline(device, meshPipelineRTXSubgroups, 0);
 		vkDestroyDescriptorSetLayout(device, setLayoutRTX, 0);
 	}
 
@@ -1158,13 +1903,20 @@ int main(int argc, const char** argv)
 		vkDestroyPipelineLayout(device, meshLayoutRTX, 0);
 	}
 
+	destroyShader(meshletcullCS, device);
+	destroyShader(drawcullCS, device);
+	destroyShader(depthreduceCS, device);
 	destroyShader(meshFS, device);
 	destroyShader(meshVS, device);
 	if (rtxSupported) {
 		destroyShader(meshMS, device);
 		destroyShader(meshTS, device);
 	}
+	if (taskSubgroupsSupported) {
+		destroyShader(meshTSSubgroups, device);
+	}
 
+	vkDestroyRenderPass(device, renderPassLate, 0);
 	vkDestroyRenderPass(device, renderPass, 0);
 
 	vkDestroySemaphore(device, releaseSemaphore, 0);
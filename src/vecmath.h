@@ -0,0 +1,66 @@
+#pragma once
+
+#include <math.h>
+
+// Just enough vector math for the camera and for placing meshes; matrices are column-major like GLSL's
+struct vec3 {
+	float x, y, z;
+};
+
+struct quat {
+	float x, y, z, w;
+};
+
+struct mat4 {
+	float m[16];
+};
+
+inline vec3 operator+(vec3 a, vec3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+inline vec3 operator-(vec3 a, vec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline vec3 operator*(vec3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+
+inline float dot(vec3 a, vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline vec3 cross(vec3 a, vec3 b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+inline float length(vec3 a) { return sqrtf(dot(a, a)); }
+
+inline quat axisAngle(vec3 axis, float angle)
+{
+	float s = sinf(angle * 0.5f);
+	return { axis.x * s, axis.y * s, axis.z * s, cosf(angle * 0.5f) };
+}
+
+// Rotation by b followed by rotation by a
+inline quat operator*(quat a, quat b)
+{
+	return {
+		a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+		a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+		a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+		a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+	};
+}
+
+// Same as rotateQuat in shaders/mesh.h
+inline vec3 rotate(vec3 v, quat q)
+{
+	vec3 u = { q.x, q.y, q.z };
+	return v + cross(u, cross(u, v) + v * q.w) * 2.f;
+}
+
+// World to view transform of a camera at position with the given orientation; the camera looks down -Z with +Y up in its own frame
+inline mat4 viewMatrix(vec3 position, quat orientation)
+{
+	quat inverse = { -orientation.x, -orientation.y, -orientation.z, orientation.w };
+
+	vec3 x = rotate({ 1, 0, 0 }, inverse);
+	vec3 y = rotate({ 0, 1, 0 }, inverse);
+	vec3 z = rotate({ 0, 0, 1 }, inverse);
+	vec3 t = rotate(position, inverse) * -1.f;
+
+	return { {
+		x.x, x.y, x.z, 0,
+		y.x, y.y, y.z, 0,
+		z.x, z.y, z.z, 0,
+		t.x, t.y, t.z, 1,
+	} };
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+#include "mesh.h"
+#include "half.h"
+
+// CPU side of the layouts in shaders/vertex.h; the GLSL decode lives next to the layout definitions
+// Positions and texcoords are encoded as whole arrays since they are shared by many vertices, which lets
+// the half formats use the batch conversion kernels; normals are encoded per vertex
+template <typename V> struct VertexPolicy;
+
+inline int8_t encodeSnorm8(float v)
+{
+	v = v < -1.f ? -1.f : (v > 1.f ? 1.f : v);
+	return int8_t(v * 127.f + (v >= 0.f ? 0.5f : -0.5f));
+}
+
+inline void encodeOctahedron(int8_t& u, int8_t& v, const float* normal)
+{
+	float nx = normal[0], ny = normal[1], nz = normal[2];
+
+	float length = fabsf(nx) + fabsf(ny) + fabsf(nz);
+	float invlength = length == 0.f ? 0.f : 1 / length;
+
+	nx *= invlength;
+	ny *= invlength;
+
+	// lower hemisphere is folded over the diagonals
+	if (nz < 0.f) {
+		float fx = (1 - fabsf(ny)) * (nx >= 0.f ? 1.f : -1.f);
+		float fy = (1 - fabsf(nx)) * (ny >= 0.f ? 1.f : -1.f);
+
+		nx = fx;
+		ny = fy;
+	}
+
+	u = encodeSnorm8(nx);
+	v = encodeSnorm8(ny);
+}
+
+template <> struct VertexPolicy<VertexHalf> {
+	typedef uint16_t Position;
+	typedef uint16_t Texcoord;
+
+	static void encodePositions(Position* result, const float* source, size_t count, const Mesh&) { convertFloatToHalf(result, source, count); }
+	static void decodePositions(float* result, const Position* source, size_t count, const Mesh&) { convertHalfToFloat(result, source, count); }
+	static void encodeTexcoords(Texcoord* result, const float* source, size_t count) { convertFloatToHalf(result, source, count); }
+
+	static VertexHalf makeVertex(const Position* position, const float* normal, const Texcoord* texcoord)
+	{
+		VertexHalf v =
+		{
+			position[0], position[1], position[2], uint16_t(0),
+			uint8_t(normal[0] * 127.0f + 127.0f),
+			uint8_t(normal[1] * 127.0f + 127.0f),
+			uint8_t(normal[2] * 127.0f + 127.0f),
+			uint8_t(0),
+			texcoord[0], texcoord[1],
+		};
+
+		return v;
+	}
+};
+
+template <> struct VertexPolicy<VertexCompact> {
+	typedef uint16_t Position;
+	typedef uint16_t Texcoord;
+
+	static void encodePositions(Position* result, const float* source, size_t count, const Mesh&) { convertFloatToHalf(result, source, count); }
+	static void decodePositions(float* result, const Position* source, size_t count, const Mesh&) { convertHalfToFloat(result, source, count); }
+	static void encodeTexcoords(Texcoord* result, const float*, size_t count) { memset(result, 0, count * sizeof(Texcoord)); }
+
+	static VertexCompact makeVertex(const Position* position, const float* normal, const Texcoord*)
+	{
+		VertexCompact v = {};
+		v.vx = position[0];
+		v.vy = position[1];
+		v.vz = position[2];
+		encodeOctahedron(v.nu, v.nv, normal);
+
+		return v;
+	}
+};
+
+template <> struct VertexPolicy<VertexUnorm16> {
+	typedef uint16_t Position;
+	typedef uint16_t Texcoord;
+
+	static void encodePositions(Position* result, const float* source, size_t count, const Mesh& mesh)
+	{
+		// the scale is uniform so that the quantization grid is the same along all axes
+		float invscale = mesh.positionScale == 0.f ? 0.f : 1 / mesh.positionScale;
+
+		for (size_t i = 0; i < count; ++i) {
+			float v = (source[i] - mesh.positionOffset[i % 3]) * invscale;
+
+			result[i] = uint16_t(v < 0.f ? 0.f : (v > 65535.f ? 65535.f : v + 0.5f));
+		}
+	}
+
+	static void decodePositions(float* result, const Position* source, size_t count, const Mesh& mesh)
+	{
+		for (size_t i = 0; i < count; ++i)
+			result[i] = mesh.positionOffset[i % 3] + float(source[i]) * mesh.positionScale;
+	}
+
+	static void encodeTexcoords(Texcoord* result, const float* source, size_t count) { convertFloatToHalf(result, source, count); }
+
+	static VertexUnorm16 makeVertex(const Position* position, const float* normal, const Texcoord* texcoord)
+	{
+		VertexUnorm16 v = {};
+		v.vx = position[0];
+		v.vy = position[1];
+		v.vz = position[2];
+		encodeOctahedron(v.nu, v.nv, normal);
+		v.tu = texcoord[0];
+		v.tv = texcoord[1];
+
+		return v;
+	}
+};
+
+template <> struct VertexPolicy<VertexFloat> {
+	typedef float Position;
+	typedef float Texcoord;
+
+	static void encodePositions(Position* result, const float* source, size_t count, const Mesh&) { memcpy(result, source, count * sizeof(float)); }
+	static void decodePositions(float* result, const Position* source, size_t count, const Mesh&) { memcpy(result, source, count * sizeof(float)); }
+	static void encodeTexcoords(Texcoord* result, const float* source, size_t count) { memcpy(result, source, count * sizeof(float)); }
+
+	static VertexFloat makeVertex(const Position* position, const float* normal, const Texcoord* texcoord)
+	{
+		VertexFloat v =
+		{
+			position[0], position[1], position[2],
+			normal[0], normal[1], normal[2],
+			texcoord[0], texcoord[1],
+		};
+
+		return v;
+	}
+};
+
+typedef VertexPolicy<Vertex> VertexEncoder;